@@ -0,0 +1,484 @@
+// Generates a synthetic OBJ/MTL scene and times the loader phase by phase.
+// Every phase is a separate pass over the file that does a little more work
+// than the previous one, so the difference between two phases is the cost of
+// the step that was added. The results are printed as JSON, together with the
+// number of heap allocations that each phase makes. If the model is also
+// built in parallel, the program fails unless both builds are the same.
+//
+// Usage: bench-loader [--size MB] [--polygon N] [--grid N] [--negative]
+//                     [--no-normals] [--mixed-normals] [--materials N]
+//                     [--switch-every N] [--threads N] [--repeat N]
+//                     [--no-upload] [--keep] [--out DIR]
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <new>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+#include <sys/resource.h>
+#include <glad.h>
+#include <GLFW/glfw3.h>
+#include "mesh.hh"
+#include "parallel.hh"
+#include "obj_parser/mapped_file.hh"
+#include "obj_parser/parser.hh"
+#include "obj_parser/reader.hh"
+#include "obj_parser/tokenizer.hh"
+
+// Every allocation that goes through operator new is counted, which includes
+// those of all standard containers.
+static std::atomic<size_t> allocationCount {0};
+
+void *operator new(size_t size)
+{
+	++allocationCount;
+	if (void *memory = std::malloc(size > 0 ? size : 1)) {
+		return memory;
+	}
+	throw std::bad_alloc();
+}
+
+void operator delete(void *memory) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete(void *memory, size_t) noexcept
+{
+	std::free(memory);
+}
+
+struct Options {
+	double sizeMB {64.0};
+	// Number of corners per face.
+	int polygon {4};
+	// Every object is a grid of grid x grid vertices.
+	int grid {64};
+	bool negative {false};
+	bool normals {true};
+	// Only every other object has normals, the others get generated ones.
+	bool mixedNormals {false};
+	int materials {8};
+	// A usemtl statement is emitted after this many faces. Zero disables them.
+	int switchEvery {256};
+	unsigned threads {0};
+	// Every phase is timed this many times and the best time is reported.
+	int repeat {3};
+	bool upload {true};
+	bool keep {false};
+	std::filesystem::path directory {std::filesystem::temp_directory_path()};
+};
+
+static Options parseOptions(int argc, char **argv)
+{
+	Options options;
+	for (int i = 1; i < argc; ++i) {
+		std::string_view arg = argv[i];
+		auto value = [&] {
+			if (i + 1 >= argc) {
+				util::fatalError("Missing value for ", argv[i]);
+			}
+			return argv[++i];
+		};
+		if (arg == "--size") {
+			options.sizeMB = std::atof(value());
+		} else if (arg == "--polygon") {
+			options.polygon = std::max(3, std::atoi(value()));
+		} else if (arg == "--grid") {
+			options.grid = std::max(2, std::atoi(value()));
+		} else if (arg == "--negative") {
+			options.negative = true;
+		} else if (arg == "--no-normals") {
+			options.normals = false;
+		} else if (arg == "--mixed-normals") {
+			options.mixedNormals = true;
+		} else if (arg == "--materials") {
+			options.materials = std::max(1, std::atoi(value()));
+		} else if (arg == "--switch-every") {
+			options.switchEvery = std::max(0, std::atoi(value()));
+		} else if (arg == "--threads") {
+			options.threads = static_cast<unsigned>(std::atoi(value()));
+		} else if (arg == "--repeat") {
+			options.repeat = std::max(1, std::atoi(value()));
+		} else if (arg == "--no-upload") {
+			options.upload = false;
+		} else if (arg == "--keep") {
+			options.keep = true;
+		} else if (arg == "--out") {
+			options.directory = value();
+		} else {
+			util::fatalError("Unknown option: ", argv[i]);
+		}
+	}
+	if (options.threads == 0) {
+		options.threads = util::hardwareThreadCount();
+	}
+	return options;
+}
+
+// Buffered writer for the generated files. Numbers are formatted with
+// std::to_chars, which keeps generating a multi-gigabyte file reasonably fast.
+class Writer {
+	std::FILE *file;
+	std::string buffer;
+	size_t written {0};
+public:
+	explicit Writer(std::filesystem::path const &path)
+		: file(std::fopen(path.c_str(), "wb"))
+	{
+		if (!file) {
+			util::fatalError("Could not create file: ", path);
+		}
+	}
+
+	Writer(Writer const &) = delete;
+
+	Writer &operator=(Writer const &) = delete;
+
+	~Writer()
+	{
+		flush();
+		std::fclose(file);
+	}
+
+	[[nodiscard]] size_t size() const
+	{
+		return written + buffer.size();
+	}
+
+	Writer &operator<<(std::string_view text)
+	{
+		buffer += text;
+		if (buffer.size() > (1 << 20)) {
+			flush();
+		}
+		return *this;
+	}
+
+	Writer &operator<<(char c)
+	{
+		return *this << std::string_view(&c, 1);
+	}
+
+	template<typename T, typename = std::enable_if_t<std::is_arithmetic_v<T>>>
+	Writer &operator<<(T number)
+	{
+		char text[32];
+		auto end = std::to_chars(text, text + sizeof(text), number).ptr;
+		return *this << std::string_view(text, static_cast<size_t>(end - text));
+	}
+
+	void flush()
+	{
+		std::fwrite(buffer.data(), 1, buffer.size(), file);
+		written += buffer.size();
+		buffer.clear();
+	}
+};
+
+struct Scene {
+	std::filesystem::path objPath;
+	std::filesystem::path mtlPath;
+	size_t bytes {0};
+	size_t objects {0};
+	size_t faces {0};
+};
+
+// Writes grid-shaped objects until the file reaches the requested size. Faces
+// with more than three corners are convex strips along a row of the grid.
+static Scene generateScene(Options const &options)
+{
+	Scene scene;
+	scene.objPath = options.directory / "vwa-bench-scene.obj";
+	scene.mtlPath = options.directory / "vwa-bench-scene.mtl";
+
+	{
+		Writer mtl(scene.mtlPath);
+		for (int i = 0; i < options.materials; ++i) {
+			float shade = static_cast<float>(i + 1) / static_cast<float>(options.materials);
+			mtl << "newmtl m" << i << "\nKd " << shade << ' ' << 1.0f - shade << " 0.5\n";
+		}
+	}
+
+	Writer obj(scene.objPath);
+	obj << "mtllib " << scene.mtlPath.filename().string() << '\n';
+	auto const targetBytes = static_cast<size_t>(options.sizeMB * (1 << 20));
+	int const grid = options.grid;
+	int const bottom = (options.polygon + 1) / 2;
+	int const top = options.polygon / 2;
+	long vertexCount = 0;
+	long normalCount = 0;
+	size_t faceCount = 0;
+	int material = 0;
+
+	while (obj.size() < targetBytes) {
+		obj << "o object" << scene.objects << '\n';
+		bool normals = options.normals && !(options.mixedNormals && scene.objects % 2 == 0);
+		for (int row = 0; row < grid; ++row) {
+			for (int column = 0; column < grid; ++column) {
+				float x = static_cast<float>(column) * 0.05f;
+				float z = static_cast<float>(row) * 0.05f;
+				float y = 0.1f * std::sin(x * 3.0f + static_cast<float>(scene.objects)) * std::cos(z * 2.0f);
+				obj << "v " << x << ' ' << y + static_cast<float>(scene.objects) << ' ' << z << '\n';
+				if (normals) {
+					obj << "vn " << -y << " 1 " << y * 0.5f << '\n';
+				}
+			}
+		}
+
+		// Writes a corner for vertex (row, column) of the current object.
+		auto corner = [&](int row, int column) {
+			long local = row * grid + column;
+			long index = options.negative ? local - grid * grid : vertexCount + local + 1;
+			obj << ' ' << index;
+			if (normals) {
+				// Relative indexes are the same in both lists.
+				obj << "//" << (options.negative ? index : normalCount + local + 1);
+			}
+		};
+
+		for (int row = 0; row + 1 < grid; ++row) {
+			for (int column = 0; column + bottom - 1 < grid; column += std::max(1, bottom - 1)) {
+				if (options.switchEvery > 0 && faceCount % options.switchEvery == 0) {
+					obj << "usemtl m" << material << '\n';
+					material = (material + 1) % options.materials;
+				}
+				obj << "f";
+				for (int i = 0; i < bottom; ++i) {
+					corner(row, column + i);
+				}
+				for (int i = top - 1; i >= 0; --i) {
+					corner(row + 1, column + i * (bottom - 1) / std::max(1, top - 1));
+				}
+				obj << "\n";
+				++faceCount;
+			}
+		}
+
+		vertexCount += static_cast<long>(grid) * grid;
+		if (normals) {
+			normalCount += static_cast<long>(grid) * grid;
+		}
+		++scene.objects;
+	}
+	obj.flush();
+	scene.bytes = obj.size();
+	scene.faces = faceCount;
+	return scene;
+}
+
+struct Measurement {
+	double seconds;
+	// Average number of allocations of a single run.
+	size_t allocations;
+};
+
+struct Phase {
+	char const *name;
+	Measurement measurement;
+};
+
+template<typename Function>
+static Measurement measure(int repeat, Function const &function)
+{
+	double best = 1e30;
+	size_t allocations = allocationCount;
+	for (int i = 0; i < repeat; ++i) {
+		auto start = std::chrono::steady_clock::now();
+		function();
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		best = std::min(best, elapsed.count());
+	}
+	return {best, (allocationCount - allocations) / static_cast<size_t>(repeat)};
+}
+
+// Splits every face into triangles, but only sums up their corners, so the
+// phase does not depend on how the triangles are stored.
+struct TriangleCounter: ObjVisitor {
+	size_t triangles {0};
+	size_t checksum {0};
+
+	void onFace(Corner const *face, size_t count)
+	{
+		triangulate(face, count, [&](Corner a, Corner b, Corner c) {
+			++triangles;
+			checksum += a.position + b.normal + c.position;
+		});
+	}
+};
+
+// Compares the meshes bit by bit, since the parser promises the same result
+// for every number of threads.
+static bool isSameModel(ModelData const &a, ModelData const &b)
+{
+	auto isSameMesh = [](MeshData const &x, MeshData const &y) {
+		return x.indices == y.indices && x.vertices.size() == y.vertices.size() &&
+		       std::memcmp(x.vertices.data(), y.vertices.data(), x.vertices.size() * sizeof(Vertex)) == 0;
+	};
+	return std::equal(a.meshes.begin(), a.meshes.end(), b.meshes.begin(), b.meshes.end(), isSameMesh);
+}
+
+// Creates an invisible window for the upload phase. Returns nullptr if there
+// is no display.
+static GLFWwindow *createHiddenWindow()
+{
+	if (!glfwInit()) {
+		return nullptr;
+	}
+	glfwWindowHint(GLFW_VISIBLE, false);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, true);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	GLFWwindow *window = glfwCreateWindow(64, 64, "bench-loader", nullptr, nullptr);
+	if (!window) {
+		glfwTerminate();
+		return nullptr;
+	}
+	glfwMakeContextCurrent(window);
+	if (!gladLoadGLLoader((GLADloadproc) glfwGetProcAddress)) {
+		glfwDestroyWindow(window);
+		glfwTerminate();
+		return nullptr;
+	}
+	return window;
+}
+
+int main(int argc, char **argv)
+{
+	try {
+		Options options = parseOptions(argc, argv);
+
+		Scene scene;
+		double generateTime = measure(1, [&] {
+			scene = generateScene(options);
+		}).seconds;
+
+		std::vector<Phase> phases;
+		size_t checksum = 0;
+		MappedFile file(scene.objPath);
+		std::string_view text = file.view();
+
+		// The file has just been written, so this measures mapping a file that
+		// is in the page cache.
+		phases.push_back({"io", measure(options.repeat, [&] {
+			MappedFile mapping(scene.objPath);
+			std::string_view bytes = mapping.view();
+			for (size_t i = 0; i < bytes.size(); i += 4096) {
+				checksum += static_cast<unsigned char>(bytes[i]);
+			}
+		})});
+		phases.push_back({"tokenize", measure(options.repeat, [&] {
+			Tokenizer tokens(text);
+			while (!tokens.atEnd()) {
+				while (!tokens.nextToken().empty()) {
+					++checksum;
+				}
+				tokens.skipLine();
+			}
+		})});
+		phases.push_back({"resolve", measure(options.repeat, [&] {
+			ObjVisitor visitor;
+			ObjReader reader;
+			reader.read(text, visitor);
+			checksum += reader.fail();
+		})});
+		phases.push_back({"triangulate", measure(options.repeat, [&] {
+			TriangleCounter counter;
+			ObjReader reader;
+			reader.read(text, counter);
+			checksum += counter.triangles + counter.checksum;
+		})});
+
+		ModelData model;
+		phases.push_back({"build", measure(options.repeat, [&] {
+			model = parseObjFile(scene.objPath, 1);
+		})});
+		if (options.threads > 1) {
+			ModelData serial = std::move(model);
+			model = {};
+			phases.push_back({"build_parallel", measure(options.repeat, [&] {
+				model = parseObjFile(scene.objPath, options.threads);
+			})});
+			if (!isSameModel(serial, model)) {
+				util::fatalError("The parallel build differs from the serial one");
+			}
+		}
+
+		size_t triangles = 0;
+		size_t vertices = 0;
+		for (auto const &mesh: model.meshes) {
+			triangles += mesh.indices.size() / 3;
+			vertices += mesh.vertices.size();
+		}
+
+		bool uploaded = false;
+		if (GLFWwindow *window = options.upload ? createHiddenWindow() : nullptr) {
+			phases.push_back({"upload", measure(options.repeat, [&] {
+				auto arena = std::make_shared<GeometryArena>();
+				std::vector<Mesh> meshes;
+				for (auto const &mesh: model.meshes) {
+					meshes.emplace_back(arena, mesh);
+				}
+				glFinish();
+			})});
+			uploaded = true;
+			glfwDestroyWindow(window);
+			glfwTerminate();
+		}
+
+		struct rusage usage {};
+		getrusage(RUSAGE_SELF, &usage);
+		double megabytes = static_cast<double>(scene.bytes) / (1 << 20);
+
+		std::printf("{\n");
+		std::printf("  \"scene\": {\"bytes\": %zu, \"objects\": %zu, \"faces\": %zu, \"polygon\": %d, "
+		            "\"negative\": %s, \"normals\": %s, \"materials\": %d, \"switch_every\": %d, "
+		            "\"generate_seconds\": %.3f},\n",
+		            scene.bytes, scene.objects, scene.faces, options.polygon, options.negative ? "true" : "false",
+		            options.normals ? "true" : "false", options.materials, options.switchEvery, generateTime);
+		std::printf("  \"threads\": %u,\n", options.threads);
+		std::printf("  \"phases\": [\n");
+		double previous = 0.0;
+		for (size_t i = 0; i < phases.size(); ++i) {
+			Phase const &phase = phases[i];
+			double seconds = phase.measurement.seconds;
+			// The parallel build and the upload do not build on the previous pass.
+			bool standalone = std::strcmp(phase.name, "build_parallel") == 0 || std::strcmp(phase.name, "upload") == 0;
+			double exclusive = standalone ? seconds : seconds - previous;
+			std::printf("    {\"name\": \"%s\", \"seconds\": %.4f, \"exclusive_seconds\": %.4f, "
+			            "\"mb_per_s\": %.1f, \"triangles_per_s\": %.0f, \"allocations\": %zu}%s\n",
+			            phase.name, seconds, exclusive, megabytes / seconds, static_cast<double>(triangles) / seconds,
+			            phase.measurement.allocations, i + 1 < phases.size() ? "," : "");
+			if (!standalone) {
+				previous = seconds;
+			}
+		}
+		std::printf("  ],\n");
+		std::printf("  \"uploaded\": %s,\n", uploaded ? "true" : "false");
+		std::printf("  \"triangles\": %zu,\n", triangles);
+		std::printf("  \"unique_vertices\": %zu,\n", vertices);
+		std::printf("  \"peak_rss_mb\": %.1f,\n", static_cast<double>(usage.ru_maxrss) / 1024);
+		std::printf("  \"checksum\": %zu\n", checksum);
+		std::printf("}\n");
+
+		if (!options.keep) {
+			std::filesystem::remove(scene.objPath);
+			std::filesystem::remove(scene.mtlPath);
+		}
+	} catch (std::string &message) {
+		std::fprintf(stderr, "%s\n", message.c_str());
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
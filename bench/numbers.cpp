@@ -0,0 +1,153 @@
+// Compares std::istream, strtof and parseFloat/parseIndex on the numbers of
+// an OBJ file that is repeated in memory to get stable timings.
+//
+// Usage: bench-numbers [file.obj] [repetitions]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "obj_parser/numbers.hh"
+#include "util.hh"
+
+struct Tokens {
+	std::string floatText;
+	std::vector<std::string_view> floats;
+	std::string indexText;
+	std::vector<std::string_view> indices;
+};
+
+// Collects the numbers of all v/vn lines and face corners. Every token is
+// followed by a space, so strtof can run directly on the buffer.
+static Tokens collectTokens(std::string const &source, int repetitions)
+{
+	Tokens tokens;
+	for (int r = 0; r < repetitions; ++r) {
+		std::istringstream lines(source);
+		std::string line;
+		while (std::getline(lines, line)) {
+			std::istringstream words(line);
+			std::string word;
+			words >> word;
+			if (word == "v" || word == "vn") {
+				while (words >> word) {
+					tokens.floatText += word + ' ';
+				}
+			} else if (word == "f") {
+				while (words >> word) {
+					for (char &c: word) {
+						c = c == '/' ? ' ' : c;
+					}
+					tokens.indexText += word + ' ';
+				}
+			}
+		}
+	}
+
+	auto split = [](std::string const &text, std::vector<std::string_view> &out) {
+		std::string_view rest = text;
+		while (!rest.empty()) {
+			size_t space = rest.find(' ');
+			if (space > 0) {
+				out.push_back(rest.substr(0, space));
+			}
+			rest.remove_prefix(space + 1);
+		}
+	};
+	split(tokens.floatText, tokens.floats);
+	split(tokens.indexText, tokens.indices);
+	return tokens;
+}
+
+template<typename Function>
+static double measure(Function function)
+{
+	double best = 1e30;
+	for (int i = 0; i < 5; ++i) {
+		auto start = std::chrono::steady_clock::now();
+		function();
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		best = std::min(best, elapsed.count());
+	}
+	return best;
+}
+
+static void report(char const *name, double seconds, size_t count, double baseline)
+{
+	std::printf("%-24s %8.2f ms %8.1f M/s %6.2fx\n", name, seconds * 1e3, count / seconds / 1e6,
+	            baseline / seconds);
+}
+
+int main(int argc, char **argv)
+{
+	char const *path = argc > 1 ? argv[1] : "assets/trees.obj";
+	int repetitions = argc > 2 ? std::atoi(argv[2]) : 50;
+
+	Tokens tokens;
+	try {
+		tokens = collectTokens(util::readFileAsString(path), repetitions);
+	} catch (std::string &message) {
+		std::fprintf(stderr, "%s\n", message.c_str());
+		return EXIT_FAILURE;
+	}
+	size_t floatCount = tokens.floats.size();
+	size_t indexCount = tokens.indices.size();
+	std::printf("%s x%d: %zu floats, %zu indices\n", path, repetitions, floatCount, indexCount);
+
+	std::vector<float> expected(floatCount);
+	std::vector<float> actual(floatCount);
+
+	double streamTime = measure([&] {
+		std::istringstream stream(tokens.floatText);
+		for (float &f: expected) {
+			stream >> f;
+		}
+	});
+	double strtofTime = measure([&] {
+		for (size_t i = 0; i < floatCount; ++i) {
+			actual[i] = std::strtof(tokens.floats[i].data(), nullptr);
+		}
+	});
+	double fastTime = measure([&] {
+		for (size_t i = 0; i < floatCount; ++i) {
+			parseFloat(tokens.floats[i], actual[i]);
+		}
+	});
+	if (std::memcmp(expected.data(), actual.data(), floatCount * sizeof(float)) != 0) {
+		std::fprintf(stderr, "parseFloat is not bit-identical to std::istream\n");
+		return EXIT_FAILURE;
+	}
+
+	report("istream >> float", streamTime, floatCount, streamTime);
+	report("strtof", strtofTime, floatCount, streamTime);
+	report("parseFloat", fastTime, floatCount, streamTime);
+
+	std::vector<size_t> expectedIndices(indexCount);
+	std::vector<long> actualIndices(indexCount);
+
+	streamTime = measure([&] {
+		std::istringstream stream(tokens.indexText);
+		for (size_t &index: expectedIndices) {
+			stream >> index;
+		}
+	});
+	fastTime = measure([&] {
+		for (size_t i = 0; i < indexCount; ++i) {
+			parseIndex(tokens.indices[i], actualIndices[i]);
+		}
+	});
+	for (size_t i = 0; i < indexCount; ++i) {
+		if (expectedIndices[i] != static_cast<size_t>(actualIndices[i])) {
+			std::fprintf(stderr, "parseIndex does not match std::istream\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	report("istream >> size_t", streamTime, indexCount, streamTime);
+	report("parseIndex", fastTime, indexCount, streamTime);
+	return EXIT_SUCCESS;
+}
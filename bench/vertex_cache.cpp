@@ -0,0 +1,93 @@
+// Measures how well the index buffers of OBJ files use the post-transform
+// vertex cache, and how much overdraw they cause, as parsed, after
+// optimizeVertexCache, and after all of optimizeMesh. ACMR is the number of
+// transformed vertices per triangle, ATVR the number per vertex, both for a
+// simulated FIFO cache of 16 and 32 entries. Overdraw is the number of shaded
+// fragments per covered pixel, see analyzeOverdraw.
+//
+// Usage: bench-vertex-cache file.obj...
+
+#include <chrono>
+#include <cstdio>
+#include <vector>
+#include "obj_parser/parser.hh"
+#include "obj_parser/mesh_optimizer.hh"
+
+struct Totals {
+	double transformed16 {0.0};
+	double transformed32 {0.0};
+	size_t triangles {0};
+	size_t vertices {0};
+	OverdrawStats overdraw;
+};
+
+static Totals analyze(std::vector<MeshData> const &meshes)
+{
+	Totals totals;
+	for (auto const &mesh: meshes) {
+		size_t triangleCount = mesh.indices.size() / 3;
+		totals.transformed16 += analyzeVertexCache(mesh.indices, mesh.vertices.size(), 16).acmr * triangleCount;
+		totals.transformed32 += analyzeVertexCache(mesh.indices, mesh.vertices.size(), 32).acmr * triangleCount;
+		totals.triangles += triangleCount;
+		totals.vertices += mesh.vertices.size();
+		OverdrawStats overdraw = analyzeOverdraw(mesh);
+		totals.overdraw.covered += overdraw.covered;
+		totals.overdraw.shaded += overdraw.shaded;
+	}
+	return totals;
+}
+
+static void print(char const *name, Totals const &totals, double milliseconds)
+{
+	double triangles = static_cast<double>(totals.triangles);
+	double vertices = static_cast<double>(totals.vertices);
+	std::printf("  %-12s ACMR %.3f / %.3f  ATVR %.3f / %.3f  overdraw %.3f", name,
+	            totals.transformed16 / triangles, totals.transformed32 / triangles,
+	            totals.transformed16 / vertices, totals.transformed32 / vertices, totals.overdraw.overdraw());
+	if (milliseconds > 0.0) {
+		std::printf("  %.2f ms", milliseconds);
+	}
+	std::printf("\n");
+}
+
+template<typename Function>
+static double measure(Function const &function)
+{
+	auto start = std::chrono::steady_clock::now();
+	function();
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2) {
+		std::fprintf(stderr, "Usage: %s file.obj...\n", argv[0]);
+		return 1;
+	}
+	for (int i = 1; i < argc; ++i) {
+		try {
+			ModelData model = parseObjFile(argv[i]);
+			std::printf("%s: %zu meshes (FIFO 16 / 32)\n", argv[i], model.meshes.size());
+			print("parsed", analyze(model.meshes), 0.0);
+
+			std::vector<MeshData> meshes = model.meshes;
+			double milliseconds = measure([&] {
+				for (auto &mesh: meshes) {
+					optimizeVertexCache(mesh.indices, mesh.vertices.size());
+				}
+			});
+			print("vertex cache", analyze(meshes), milliseconds);
+
+			milliseconds = measure([&] {
+				for (auto &mesh: model.meshes) {
+					optimizeMesh(mesh);
+				}
+			});
+			print("optimized", analyze(model.meshes), milliseconds);
+		} catch (std::string &message) {
+			std::fprintf(stderr, "%s: %s\n", argv[i], message.c_str());
+			return 1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <map>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <filesystem>
+#include "util.hh"
+
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/inotify.h>
+#endif
+
+// Reports files that have been written. On Linux, the directories of the
+// files are watched with inotify, so that files which editors replace by
+// renaming a new version over them are noticed as well. Elsewhere, the
+// modification times are compared on every poll.
+class FileWatcher {
+	// Watched files by their absolute path, and the path they were added with.
+	std::map<std::filesystem::path, std::filesystem::path> files;
+#if defined(__linux__)
+	int fd {-1};
+	// Watched directories by watch descriptor.
+	std::map<int, std::filesystem::path> directories;
+#else
+	std::map<std::filesystem::path, std::filesystem::file_time_type> writeTimes;
+#endif
+public:
+	FileWatcher()
+	{
+#if defined(__linux__)
+		fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (fd < 0) {
+			util::fatalError("Could not create inotify instance");
+		}
+#endif
+	}
+
+	FileWatcher(FileWatcher const &) = delete;
+
+	FileWatcher &operator=(FileWatcher const &) = delete;
+
+	~FileWatcher()
+	{
+#if defined(__linux__)
+		close(fd);
+#endif
+	}
+
+	// Does nothing if the file is watched already.
+	void watch(std::filesystem::path const &path)
+	{
+		std::filesystem::path absolute = std::filesystem::absolute(path).lexically_normal();
+		if (!files.emplace(absolute, path).second) {
+			return;
+		}
+#if defined(__linux__)
+		std::filesystem::path directory = absolute.parent_path();
+		int wd = inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+		if (wd < 0) {
+			util::fatalError("Could not watch directory: ", directory);
+		}
+		directories[wd] = directory;
+#else
+		std::error_code error;
+		writeTimes[absolute] = std::filesystem::last_write_time(absolute, error);
+#endif
+	}
+
+	// Returns the files that have been written since the last call, with the
+	// paths that they were added with. Never blocks.
+	[[nodiscard]] std::vector<std::filesystem::path> poll()
+	{
+		std::vector<std::filesystem::path> changed;
+		auto report = [&](std::filesystem::path const &absolute) {
+			auto it = files.find(absolute);
+			if (it != files.end() && std::find(changed.begin(), changed.end(), it->second) == changed.end()) {
+				changed.push_back(it->second);
+			}
+		};
+
+#if defined(__linux__)
+		alignas(inotify_event) char buffer[4096];
+		while (true) {
+			ssize_t size = read(fd, buffer, sizeof(buffer));
+			if (size <= 0) {
+				break;
+			}
+			for (ssize_t offset = 0; offset < size;) {
+				auto event = reinterpret_cast<inotify_event const *>(buffer + offset);
+				auto directory = directories.find(event->wd);
+				if (event->len > 0 && directory != directories.end()) {
+					report(directory->second / event->name);
+				}
+				offset += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+			}
+		}
+#else
+		for (auto &[absolute, writeTime]: writeTimes) {
+			std::error_code error;
+			auto time = std::filesystem::last_write_time(absolute, error);
+			if (!error && time != writeTime) {
+				writeTime = time;
+				report(absolute);
+			}
+		}
+#endif
+		return changed;
+	}
+};
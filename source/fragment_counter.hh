@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <glad.h>
+
+// Counts the samples that pass the depth test between begin() and end(), with
+// an occlusion query. Without multisampling, and with an early depth test, this
+// is the number of fragment shader invocations, so it shows how much overdraw
+// the order of the triangles causes. OpenGL 3.3 has no pipeline statistics
+// queries, which would count the invocations directly.
+//
+// The results are read a few frames later, so that the CPU never waits for the
+// GPU.
+class FragmentCounter {
+	static constexpr size_t QUERY_COUNT = 3;
+
+	GLuint queries[QUERY_COUNT] {};
+	// Queries that have been started so far.
+	size_t started {0};
+	// Whether a query is running between begin() and end().
+	bool active {false};
+	uint64_t count {0};
+public:
+	FragmentCounter()
+	{
+		glGenQueries(QUERY_COUNT, queries);
+	}
+
+	FragmentCounter(FragmentCounter const &) = delete;
+
+	FragmentCounter &operator=(FragmentCounter const &) = delete;
+
+	~FragmentCounter()
+	{
+		glDeleteQueries(QUERY_COUNT, queries);
+	}
+
+	// Reads the result of the oldest query, if it is available, and starts
+	// a new one in its place.
+	void begin()
+	{
+		GLuint query = queries[started % QUERY_COUNT];
+		if (started >= QUERY_COUNT) {
+			GLint available = 0;
+			glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available) {
+				// Skip this frame rather than wait.
+				return;
+			}
+			GLuint64 samples = 0;
+			glGetQueryObjectui64v(query, GL_QUERY_RESULT, &samples);
+			count = samples;
+		}
+		glBeginQuery(GL_SAMPLES_PASSED, query);
+		active = true;
+	}
+
+	void end()
+	{
+		if (active) {
+			glEndQuery(GL_SAMPLES_PASSED);
+			++started;
+			active = false;
+		}
+	}
+
+	// The most recent result.
+	[[nodiscard]] uint64_t getCount() const
+	{
+		return count;
+	}
+};
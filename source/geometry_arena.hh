@@ -0,0 +1,442 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <optional>
+#include <algorithm>
+#include <glad.h>
+#include <glm/glm.hpp>
+#include "packed_vertex.hh"
+#include "vertex_layout.hh"
+#include "util.hh"
+
+// Hands out ranges of a buffer, first fit. Freed ranges are merged with their
+// free neighbours.
+class RangeAllocator {
+	// Free ranges by offset, with their sizes.
+	std::map<size_t, size_t> freeRanges;
+	size_t capacity {0};
+public:
+	// Returns nothing if there is no free range that is large enough. The
+	// offset is a multiple of alignment.
+	[[nodiscard]] std::optional<size_t> allocate(size_t size, size_t alignment = 1)
+	{
+		if (size == 0) {
+			return 0;
+		}
+		auto it = findRange(size, alignment);
+		if (it == freeRanges.end()) {
+			return std::nullopt;
+		}
+		size_t first = it->first;
+		size_t begin = alignUp(first, alignment);
+		size_t end = first + it->second;
+		freeRanges.erase(it);
+		if (first < begin) {
+			freeRanges[first] = begin - first;
+		}
+		if (begin + size < end) {
+			freeRanges[begin + size] = end - begin - size;
+		}
+		return begin;
+	}
+
+	// Whether allocate would succeed.
+	[[nodiscard]] bool canAllocate(size_t size, size_t alignment = 1) const
+	{
+		return size == 0 || findRange(size, alignment) != freeRanges.end();
+	}
+
+	void release(size_t offset, size_t size)
+	{
+		if (size == 0) {
+			return;
+		}
+		size_t end = offset + size;
+		auto next = freeRanges.lower_bound(offset);
+		if (next != freeRanges.end() && next->first == end) {
+			end += next->second;
+			next = freeRanges.erase(next);
+		}
+		if (next != freeRanges.begin()) {
+			auto previous = std::prev(next);
+			if (previous->first + previous->second == offset) {
+				offset = previous->first;
+				freeRanges.erase(previous);
+			}
+		}
+		freeRanges[offset] = end - offset;
+	}
+
+	// The space between the old and the new capacity becomes free.
+	void grow(size_t newCapacity)
+	{
+		release(capacity, newCapacity - capacity);
+		capacity = newCapacity;
+	}
+
+	[[nodiscard]] size_t getCapacity() const noexcept
+	{
+		return capacity;
+	}
+
+private:
+	static size_t alignUp(size_t offset, size_t alignment) noexcept
+	{
+		return (offset + alignment - 1) / alignment * alignment;
+	}
+
+	// The first free range with room for size bytes at an aligned offset.
+	[[nodiscard]] std::map<size_t, size_t>::const_iterator findRange(size_t size, size_t alignment) const
+	{
+		for (auto it = freeRanges.begin(); it != freeRanges.end(); ++it) {
+			if (alignUp(it->first, alignment) + size <= it->first + it->second) {
+				return it;
+			}
+		}
+		return freeRanges.end();
+	}
+};
+
+// Buffers that all packed meshes of a model share, so that a pass can draw
+// them with one glMultiDrawElementsBaseVertex call per index type instead of a
+// VAO bind and a draw call per mesh, see Model::draw. There is a buffer of
+// PackedVertex and one of PackedPosition, each with a VAO, and an index buffer
+// that holds both 16 and 32-bit indices. The buffers grow as needed, and
+// meshes only keep their ranges, which stay valid.
+//
+// Uniforms cannot change between the draws of a multi-draw call, and OpenGL
+// 3.3 has neither gl_DrawID nor base instances. So the model matrix, the
+// position quantization and the constant material of every mesh are stored in
+// a texture buffer instead, where the vertex shaders look them up with the draw
+// index of the vertex. Draw indices are 32-bit and have a vertex buffer of
+// their own, which both VAOs read, so the vertices themselves do not depend on
+// where a mesh ends up. Meshes with their own buffers have draw data as well,
+// and set their draw index as a constant vertex attribute.
+class GeometryArena {
+public:
+	// Where a mesh is in the buffers.
+	struct Range {
+		size_t baseVertex {0};
+		size_t vertexCount {0};
+		// In bytes.
+		size_t indexOffset {0};
+		size_t indexCount {0};
+		GLenum indexType {GL_UNSIGNED_INT};
+	};
+
+	// Vertex attribute locations, as in the shaders.
+	static constexpr GLuint POSITION_LOCATION = 0;
+	static constexpr GLuint NORMAL_LOCATION = 1;
+	static constexpr GLuint MATERIAL_LOCATION = 2;
+	static constexpr GLuint DRAW_LOCATION = 3;
+
+	// The draw data of a mesh: the first three rows of its model matrix, the
+	// position offset with the constant material in w (-1 if the material is
+	// read from the vertices), and the position scale with the material offset
+	// in w.
+	static constexpr size_t TEXELS_PER_DRAW = 5;
+
+private:
+	static constexpr size_t MIN_VERTEX_CAPACITY = 1 << 16;
+	static constexpr size_t MIN_INDEX_CAPACITY = 1 << 20;
+	static constexpr size_t MIN_DRAW_CAPACITY = 256;
+	// In all vertex buffers together.
+	static constexpr size_t BYTES_PER_VERTEX = sizeof(PackedVertex) + sizeof(PackedPosition) + sizeof(uint32_t);
+
+	GLuint vao {0};
+	GLuint depthVao {0};
+	GLuint vertexBuffer {0};
+	GLuint positionBuffer {0};
+	GLuint drawIndexBuffer {0};
+	GLuint indexBuffer {0};
+	// In vertices and in bytes.
+	RangeAllocator vertices;
+	RangeAllocator indexBytes;
+
+	GLuint drawBuffer {0};
+	GLuint drawTexture {0};
+	std::vector<glm::vec4> drawData;
+	// In draw data entries.
+	RangeAllocator draws;
+	// Texels of drawData that have changed since they were last uploaded.
+	size_t changedBegin {SIZE_MAX};
+	size_t changedEnd {0};
+	// Texels that drawBuffer has room for.
+	size_t drawBufferSize {0};
+	// Reused by updateDrawIndices.
+	std::vector<uint32_t> drawIndices;
+public:
+	GeometryArena()
+	{
+		glGenVertexArrays(1, &vao);
+		glGenVertexArrays(1, &depthVao);
+		glGenBuffers(1, &drawBuffer);
+		glGenTextures(1, &drawTexture);
+	}
+
+	GeometryArena(GeometryArena const &) = delete;
+
+	GeometryArena &operator=(GeometryArena const &) = delete;
+
+	~GeometryArena() noexcept
+	{
+		glDeleteTextures(1, &drawTexture);
+		glDeleteBuffers(1, &drawBuffer);
+		glDeleteBuffers(1, &indexBuffer);
+		glDeleteBuffers(1, &drawIndexBuffer);
+		glDeleteBuffers(1, &positionBuffer);
+		glDeleteBuffers(1, &vertexBuffer);
+		glDeleteVertexArrays(1, &depthVao);
+		glDeleteVertexArrays(1, &vao);
+	}
+
+	// The buffers grow if there is not enough room.
+	[[nodiscard]] Range allocate(size_t vertexCount, size_t indexCount, GLenum indexType)
+	{
+		Range range;
+		range.vertexCount = vertexCount;
+		range.indexCount = indexCount;
+		range.indexType = indexType;
+		size_t indexSize = getIndexSize(indexType);
+
+		std::optional<size_t> vertexOffset = vertices.allocate(vertexCount);
+		if (!vertexOffset) {
+			growVertices(vertexCount);
+			vertexOffset = vertices.allocate(vertexCount);
+		}
+		std::optional<size_t> indexOffset = indexBytes.allocate(indexCount * indexSize, indexSize);
+		if (!indexOffset) {
+			growIndices(indexCount * indexSize);
+			indexOffset = indexBytes.allocate(indexCount * indexSize, indexSize);
+		}
+		range.baseVertex = *vertexOffset;
+		range.indexOffset = *indexOffset;
+		return range;
+	}
+
+	void release(Range const &range)
+	{
+		vertices.release(range.baseVertex, range.vertexCount);
+		indexBytes.release(range.indexOffset, range.indexCount * getIndexSize(range.indexType));
+	}
+
+	// The number of bytes that allocate() would copy on the GPU to grow the
+	// buffers, or zero if there is enough room. Growing takes time in
+	// proportion to the geometry that is in the buffers already, so the
+	// loaders count it towards their upload budget.
+	[[nodiscard]] size_t getGrowthCost(size_t vertexCount, size_t indexCount, GLenum indexType) const
+	{
+		size_t indexSize = getIndexSize(indexType);
+		size_t cost = 0;
+		if (!vertices.canAllocate(vertexCount)) {
+			cost += vertices.getCapacity() * BYTES_PER_VERTEX;
+		}
+		if (!indexBytes.canAllocate(indexCount * indexSize, indexSize)) {
+			cost += indexBytes.getCapacity();
+		}
+		return cost;
+	}
+
+	// Offset and size are in bytes, relative to the range.
+	void updateVertices(Range const &range, size_t offset, void const *data, size_t size) const noexcept
+	{
+		update(vertexBuffer, range.baseVertex * sizeof(PackedVertex) + offset, data, size);
+	}
+
+	void updatePositions(Range const &range, size_t offset, void const *data, size_t size) const noexcept
+	{
+		update(positionBuffer, range.baseVertex * sizeof(PackedPosition) + offset, data, size);
+	}
+
+	void updateIndices(Range const &range, size_t offset, void const *data, size_t size) const noexcept
+	{
+		update(indexBuffer, range.indexOffset + offset, data, size);
+	}
+
+	// Sets the draw index of the vertices in part of the range, so that it can
+	// be spread over several frames like the other updates. Offset and size
+	// are in bytes of the 32-bit draw indices.
+	void updateDrawIndices(Range const &range, size_t offset, size_t size, uint32_t draw)
+	{
+		size_t skipped = offset % sizeof(uint32_t);
+		drawIndices.assign((skipped + size + sizeof(uint32_t) - 1) / sizeof(uint32_t), draw);
+		update(drawIndexBuffer, range.baseVertex * sizeof(uint32_t) + offset,
+		       reinterpret_cast<char const *>(drawIndices.data()) + skipped, size);
+	}
+
+	// Returns the index of the first of count consecutive draw data entries,
+	// one for every instance of a mesh, which have to be set before drawing.
+	// The shaders add gl_InstanceID to the draw index of the vertices. The
+	// draw data only runs out once it exceeds the largest texture buffer,
+	// see uploadDrawData.
+	[[nodiscard]] uint32_t addDraws(size_t count)
+	{
+		std::optional<size_t> first = draws.allocate(count);
+		if (!first) {
+			size_t newCapacity = grownCapacity(draws.getCapacity(), count, MIN_DRAW_CAPACITY);
+			draws.grow(newCapacity);
+			drawData.resize(newCapacity * TEXELS_PER_DRAW);
+			first = draws.allocate(count);
+		}
+		return static_cast<uint32_t>(*first);
+	}
+
+	void removeDraws(uint32_t first, size_t count)
+	{
+		draws.release(first, count);
+	}
+
+	// Without a constant material, the material is read from the vertices and
+	// materialOffset is added to it.
+	void setDraw(
+		uint32_t draw,
+		glm::mat4 const &modelMatrix,
+		PositionQuantization const &quantization,
+		std::optional<uint32_t> constantMaterial,
+		uint32_t materialOffset = 0)
+	{
+		size_t texel = draw * TEXELS_PER_DRAW;
+		glm::mat4 rows = glm::transpose(modelMatrix);
+		drawData[texel] = rows[0];
+		drawData[texel + 1] = rows[1];
+		drawData[texel + 2] = rows[2];
+		float material = constantMaterial ? static_cast<float>(*constantMaterial) : -1.0f;
+		drawData[texel + 3] = glm::vec4(quantization.offset, material);
+		drawData[texel + 4] = glm::vec4(quantization.scale, static_cast<float>(materialOffset));
+		changedBegin = std::min(changedBegin, texel);
+		changedEnd = std::max(changedEnd, texel + TEXELS_PER_DRAW);
+	}
+
+	// Uploads the draw data that has changed. Must be called before drawing.
+	void uploadDrawData()
+	{
+		if (changedBegin >= changedEnd) {
+			return;
+		}
+		glBindBuffer(GL_TEXTURE_BUFFER, drawBuffer);
+		if (drawData.size() > drawBufferSize) {
+			GLint maxTexels = 0;
+			glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+			if (drawData.size() > static_cast<size_t>(maxTexels)) {
+				util::fatalError("Too many meshes: ", std::to_string(drawData.size() / TEXELS_PER_DRAW));
+			}
+			drawBufferSize = std::min(std::max(drawData.size(), drawBufferSize * 2), static_cast<size_t>(maxTexels));
+			glBufferData(GL_TEXTURE_BUFFER, static_cast<GLsizeiptr>(drawBufferSize * sizeof(glm::vec4)), nullptr,
+			             GL_DYNAMIC_DRAW);
+			changedBegin = 0;
+			changedEnd = drawData.size();
+			glBindTexture(GL_TEXTURE_BUFFER, drawTexture);
+			glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, drawBuffer);
+		}
+		glBufferSubData(GL_TEXTURE_BUFFER, static_cast<GLintptr>(changedBegin * sizeof(glm::vec4)),
+		                static_cast<GLsizeiptr>((changedEnd - changedBegin) * sizeof(glm::vec4)),
+		                drawData.data() + changedBegin);
+		changedBegin = SIZE_MAX;
+		changedEnd = 0;
+	}
+
+	// A buffer texture with the draw data, for the uDrawData sampler.
+	[[nodiscard]] GLuint getDrawTexture() const noexcept
+	{
+		return drawTexture;
+	}
+
+	// Reads all attributes.
+	[[nodiscard]] GLuint getVao() const noexcept
+	{
+		return vao;
+	}
+
+	// Only reads the positions, and the draw index.
+	[[nodiscard]] GLuint getDepthVao() const noexcept
+	{
+		return depthVao;
+	}
+
+private:
+	static void update(GLuint buffer, size_t offset, void const *data, size_t size) noexcept
+	{
+		glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, static_cast<GLintptr>(offset), static_cast<GLsizeiptr>(size), data);
+	}
+
+	static size_t getIndexSize(GLenum indexType) noexcept
+	{
+		return indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t);
+	}
+
+	// Returns a larger buffer with the content of the old one, which is
+	// deleted.
+	static GLuint resize(GLuint buffer, size_t size, size_t newSize)
+	{
+		GLuint resized = 0;
+		glGenBuffers(1, &resized);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, resized);
+		glBufferData(GL_COPY_WRITE_BUFFER, static_cast<GLsizeiptr>(newSize), nullptr, GL_STATIC_DRAW);
+		if (size > 0) {
+			glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, static_cast<GLsizeiptr>(size));
+		}
+		glDeleteBuffers(1, &buffer);
+		return resized;
+	}
+
+	// At least doubles the capacity, so that growing takes linear time.
+	static size_t grownCapacity(size_t capacity, size_t required, size_t minimum)
+	{
+		return std::max({capacity * 2, capacity + required, minimum});
+	}
+
+	void growVertices(size_t required)
+	{
+		size_t capacity = vertices.getCapacity();
+		size_t newCapacity = grownCapacity(capacity, required, MIN_VERTEX_CAPACITY);
+		vertexBuffer = resize(vertexBuffer, capacity * sizeof(PackedVertex), newCapacity * sizeof(PackedVertex));
+		positionBuffer = resize(positionBuffer, capacity * sizeof(PackedPosition),
+		                        newCapacity * sizeof(PackedPosition));
+		drawIndexBuffer = resize(drawIndexBuffer, capacity * sizeof(uint32_t), newCapacity * sizeof(uint32_t));
+		vertices.grow(newCapacity);
+		setUpVertexArrays();
+	}
+
+	void growIndices(size_t required)
+	{
+		size_t capacity = indexBytes.getCapacity();
+		size_t newCapacity = grownCapacity(capacity, required, MIN_INDEX_CAPACITY);
+		indexBuffer = resize(indexBuffer, capacity, newCapacity);
+		indexBytes.grow(newCapacity);
+		setUpVertexArrays();
+	}
+
+	// Points the VAOs to the current buffers.
+	void setUpVertexArrays() const
+	{
+		VertexLayout layout = VertexLayout::packed(PositionQuantization {});
+		glBindVertexArray(vao);
+		glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+		setVertexAttribute(POSITION_LOCATION, layout.position);
+		setVertexAttribute(NORMAL_LOCATION, layout.normal);
+		setIntegerVertexAttribute(MATERIAL_LOCATION, layout.material);
+		setDrawIndexAttribute();
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+
+		auto stride = static_cast<GLsizei>(sizeof(PackedPosition));
+		glBindVertexArray(depthVao);
+		glBindBuffer(GL_ARRAY_BUFFER, positionBuffer);
+		setVertexAttribute(POSITION_LOCATION, {3, GL_UNSIGNED_SHORT, true, stride, offsetof(PackedPosition, pos)});
+		setDrawIndexAttribute();
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+		glBindVertexArray(0);
+	}
+
+	void setDrawIndexAttribute() const
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, drawIndexBuffer);
+		setIntegerVertexAttribute(DRAW_LOCATION, {1, GL_UNSIGNED_INT, false, sizeof(uint32_t), 0});
+	}
+};
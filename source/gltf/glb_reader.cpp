@@ -0,0 +1,537 @@
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <iostream>
+#include <algorithm>
+#include "glb_reader.hh"
+#include "json.hh"
+#include "obj_parser/mesh_builder.hh"
+#include "obj_parser/mesh_optimizer.hh"
+#include "obj_parser/smooth_normals.hh"
+#include "util.hh"
+
+static constexpr uint32_t GLB_MAGIC = 0x46546C67;
+static constexpr uint32_t CHUNK_JSON = 0x4E4F534A;
+static constexpr uint32_t CHUNK_BIN = 0x004E4942;
+
+// glTF uses the OpenGL enums for component types and primitive modes.
+static constexpr GLenum MODE_TRIANGLES = 4;
+
+// Extensions that may be listed in extensionsRequired. Quantized attributes
+// are simply read with normalized integer formats.
+static constexpr std::string_view SUPPORTED_EXTENSIONS[] = {"KHR_mesh_quantization"};
+
+// A validated accessor. data points to the first element in the mapped file.
+struct Accessor {
+	char const *data {nullptr};
+	size_t count {0};
+	size_t stride {0};
+	size_t elementSize {0};
+	GLenum componentType {GL_FLOAT};
+	int componentCount {0};
+	bool normalized {false};
+	JsonValue const *json {nullptr};
+
+	[[nodiscard]] char const *end() const noexcept
+	{
+		return data + stride * (count - 1) + elementSize;
+	}
+};
+
+static size_t getComponentSize(GLenum type)
+{
+	switch (type) {
+	case GL_BYTE:
+	case GL_UNSIGNED_BYTE:
+		return 1;
+	case GL_SHORT:
+	case GL_UNSIGNED_SHORT:
+		return 2;
+	case GL_UNSIGNED_INT:
+	case GL_FLOAT:
+		return 4;
+	default:
+		return 0;
+	}
+}
+
+// Reads a component and applies the normalization of the accessor.
+static float readComponent(Accessor const &accessor, char const *p)
+{
+	switch (accessor.componentType) {
+	case GL_BYTE: {
+		auto value = static_cast<float>(*reinterpret_cast<int8_t const *>(p));
+		return accessor.normalized ? std::max(value / 127.0f, -1.0f) : value;
+	}
+	case GL_UNSIGNED_BYTE: {
+		auto value = static_cast<float>(*reinterpret_cast<uint8_t const *>(p));
+		return accessor.normalized ? value / 255.0f : value;
+	}
+	case GL_SHORT: {
+		int16_t raw;
+		std::memcpy(&raw, p, sizeof(raw));
+		auto value = static_cast<float>(raw);
+		return accessor.normalized ? std::max(value / 32767.0f, -1.0f) : value;
+	}
+	case GL_UNSIGNED_SHORT: {
+		uint16_t raw;
+		std::memcpy(&raw, p, sizeof(raw));
+		auto value = static_cast<float>(raw);
+		return accessor.normalized ? value / 65535.0f : value;
+	}
+	default: {
+		float value;
+		std::memcpy(&value, p, sizeof(value));
+		return value;
+	}
+	}
+}
+
+static glm::vec3 readVector3(Accessor const &accessor, size_t index)
+{
+	char const *p = accessor.data + index * accessor.stride;
+	size_t size = getComponentSize(accessor.componentType);
+	return {readComponent(accessor, p), readComponent(accessor, p + size), readComponent(accessor, p + 2 * size)};
+}
+
+static uint32_t readIndex(Accessor const &accessor, size_t index)
+{
+	char const *p = accessor.data + index * accessor.stride;
+	switch (accessor.componentType) {
+	case GL_UNSIGNED_BYTE:
+		return *reinterpret_cast<uint8_t const *>(p);
+	case GL_UNSIGNED_SHORT: {
+		uint16_t value;
+		std::memcpy(&value, p, sizeof(value));
+		return value;
+	}
+	default: {
+		uint32_t value;
+		std::memcpy(&value, p, sizeof(value));
+		return value;
+	}
+	}
+}
+
+// Builds the matrix of a node from either its matrix or its translation,
+// rotation and scale.
+static glm::mat4 getLocalMatrix(JsonValue const &node)
+{
+	glm::mat4 result(1.0f);
+	JsonValue const &matrix = node["matrix"];
+	if (matrix.size() == 16) {
+		for (int i = 0; i < 16; ++i) {
+			result[i / 4][i % 4] = static_cast<float>(matrix[i].asNumber());
+		}
+		return result;
+	}
+
+	auto component = [](JsonValue const &array, size_t i, double fallback) {
+		return static_cast<float>(array[i].asNumber(fallback));
+	};
+	JsonValue const &t = node["translation"];
+	JsonValue const &r = node["rotation"];
+	JsonValue const &s = node["scale"];
+	float x = component(r, 0, 0.0), y = component(r, 1, 0.0), z = component(r, 2, 0.0), w = component(r, 3, 1.0);
+	glm::vec3 scale(component(s, 0, 1.0), component(s, 1, 1.0), component(s, 2, 1.0));
+	result[0] = glm::vec4(1 - 2 * (y * y + z * z), 2 * (x * y + z * w), 2 * (x * z - y * w), 0.0f) * scale.x;
+	result[1] = glm::vec4(2 * (x * y - z * w), 1 - 2 * (x * x + z * z), 2 * (y * z + x * w), 0.0f) * scale.y;
+	result[2] = glm::vec4(2 * (x * z + y * w), 2 * (y * z - x * w), 1 - 2 * (x * x + y * y), 0.0f) * scale.z;
+	result[3] = glm::vec4(component(t, 0, 0.0), component(t, 1, 0.0), component(t, 2, 0.0), 1.0f);
+	return result;
+}
+
+// Collects the primitives of the scene and checks everything it reads.
+class GlbReader {
+	std::filesystem::path const &path;
+	JsonValue json;
+	std::string_view binary;
+	GlbModel &model;
+public:
+	GlbReader(std::filesystem::path const &path, GlbModel &model)
+		: path(path), model(model)
+	{
+		std::string_view file = model.file.view();
+		uint32_t header[3] {};
+		if (file.size() < sizeof(header)) {
+			fail("the file is too short");
+		}
+		std::memcpy(header, file.data(), sizeof(header));
+		if (header[0] != GLB_MAGIC || header[1] != 2 || header[2] > file.size()) {
+			fail("wrong header");
+		}
+		file = file.substr(sizeof(header), header[2] - sizeof(header));
+
+		std::string_view text;
+		for (int chunk = 0; !file.empty(); ++chunk) {
+			uint32_t chunkHeader[2] {};
+			if (file.size() < sizeof(chunkHeader)) {
+				fail("truncated chunk");
+			}
+			std::memcpy(chunkHeader, file.data(), sizeof(chunkHeader));
+			if (chunkHeader[0] > file.size() - sizeof(chunkHeader)) {
+				fail("truncated chunk");
+			}
+			std::string_view data = file.substr(sizeof(chunkHeader), chunkHeader[0]);
+			if (chunk == 0 && chunkHeader[1] == CHUNK_JSON) {
+				text = data;
+			} else if (chunk == 1 && chunkHeader[1] == CHUNK_BIN) {
+				binary = data;
+			} else if (chunk == 0) {
+				fail("the first chunk must be JSON");
+			}
+			// Unknown chunks are skipped, as the specification requires.
+			file.remove_prefix(sizeof(chunkHeader) + chunkHeader[0]);
+		}
+		json = parseJson(text);
+	}
+
+	void read()
+	{
+		if (json["asset"]["version"].asString().substr(0, 2) != "2.") {
+			fail("only glTF 2.0 is supported");
+		}
+		JsonValue const &required = json["extensionsRequired"];
+		for (size_t i = 0; i < required.size(); ++i) {
+			std::string_view name = required[i].asString();
+			if (std::find(std::begin(SUPPORTED_EXTENSIONS), std::end(SUPPORTED_EXTENSIONS), name) ==
+			    std::end(SUPPORTED_EXTENSIONS)) {
+				util::fatalError("Unsupported glTF extension ", std::string(name), " in ", path);
+			}
+		}
+
+		JsonValue const &buffers = json["buffers"];
+		for (size_t i = 0; i < buffers.size(); ++i) {
+			if (i > 0 || !buffers[i]["uri"].isNull()) {
+				fail("only the binary chunk is supported as a buffer");
+			}
+			if (getSize(buffers[i]["byteLength"]) > binary.size()) {
+				fail("the buffer is larger than the binary chunk");
+			}
+		}
+
+		readMaterials();
+
+		JsonValue const &scenes = json["scenes"];
+		if (scenes.size() > 0) {
+			JsonValue const &scene = scenes[getIndex(json["scene"], scenes.size(), 0)];
+			JsonValue const &nodes = scene["nodes"];
+			for (size_t i = 0; i < nodes.size(); ++i) {
+				readNode(getIndex(nodes[i], json["nodes"].size()), glm::mat4(1.0f), 0);
+			}
+		} else {
+			// Without a scene, every mesh is shown once at the origin.
+			for (size_t i = 0; i < json["meshes"].size(); ++i) {
+				readMesh(i, glm::mat4(1.0f));
+			}
+		}
+	}
+
+private:
+	[[noreturn]] void fail(char const *reason) const
+	{
+		util::fatalError("Invalid glTF file ", path, ": ", reason);
+	}
+
+	// Non-negative integers, such as sizes and offsets.
+	size_t getSize(JsonValue const &value, std::optional<size_t> fallback = {}) const
+	{
+		if (value.isNull() && fallback) {
+			return *fallback;
+		}
+		double number = value.asNumber(-1.0);
+		if (number < 0.0 || number > 9007199254740992.0 || std::floor(number) != number) {
+			fail("expected a non-negative integer");
+		}
+		return static_cast<size_t>(number);
+	}
+
+	size_t getIndex(JsonValue const &value, size_t count, std::optional<size_t> fallback = {}) const
+	{
+		size_t index = getSize(value, fallback);
+		if (index >= count) {
+			fail("index out of range");
+		}
+		return index;
+	}
+
+	void readMaterials()
+	{
+		model.materials.assign(1, Material {});
+		JsonValue const &materials = json["materials"];
+		for (size_t i = 0; i < materials.size(); ++i) {
+			JsonValue const &factor = materials[i]["pbrMetallicRoughness"]["baseColorFactor"];
+			Material material;
+			material.diffuse = glm::vec3(1.0f);
+			for (int k = 0; k < 3; ++k) {
+				material.diffuse[k] = static_cast<float>(factor[k].asNumber(1.0));
+			}
+			model.materials.push_back(material);
+		}
+	}
+
+	void readNode(size_t index, glm::mat4 const &parent, size_t depth)
+	{
+		JsonValue const &nodes = json["nodes"];
+		// A node can only appear once in a hierarchy, so a deeper one is a cycle.
+		if (depth > nodes.size()) {
+			fail("the node hierarchy contains a cycle");
+		}
+		JsonValue const &node = nodes[index];
+		glm::mat4 matrix = parent * getLocalMatrix(node);
+		if (!node["mesh"].isNull()) {
+			readMesh(getIndex(node["mesh"], json["meshes"].size()), matrix);
+		}
+		JsonValue const &children = node["children"];
+		for (size_t i = 0; i < children.size(); ++i) {
+			readNode(getIndex(children[i], nodes.size()), matrix, depth + 1);
+		}
+	}
+
+	void readMesh(size_t index, glm::mat4 const &matrix)
+	{
+		JsonValue const &primitives = json["meshes"][index]["primitives"];
+		for (size_t i = 0; i < primitives.size(); ++i) {
+			JsonValue const &primitive = primitives[i];
+			size_t mode = getSize(primitive["mode"], MODE_TRIANGLES);
+			if (mode != MODE_TRIANGLES) {
+				std::cout << "Skipping glTF primitive with mode " << mode << " in " << path << '\n';
+				continue;
+			}
+			readPrimitive(primitive, matrix);
+		}
+	}
+
+	Accessor getAccessor(JsonValue const &index, bool isVertexAttribute) const
+	{
+		JsonValue const &accessors = json["accessors"];
+		JsonValue const &json = accessors[getIndex(index, accessors.size())];
+		if (!json["sparse"].isNull() || json["bufferView"].isNull()) {
+			fail("sparse accessors are not supported");
+		}
+
+		Accessor result;
+		result.json = &json;
+		result.componentType = static_cast<GLenum>(getSize(json["componentType"]));
+		size_t componentSize = getComponentSize(result.componentType);
+		std::string_view type = json["type"].asString();
+		result.componentCount = type == "SCALAR" ? 1 : type == "VEC2" ? 2 : type == "VEC3" ? 3 : type == "VEC4" ? 4 : 0;
+		if (componentSize == 0 || result.componentCount == 0) {
+			fail("unsupported accessor type");
+		}
+		result.normalized = json["normalized"].asBool();
+		result.count = getSize(json["count"]);
+		result.elementSize = componentSize * result.componentCount;
+		if (result.count == 0) {
+			fail("empty accessor");
+		}
+
+		JsonValue const &views = this->json["bufferViews"];
+		JsonValue const &view = views[getIndex(json["bufferView"], views.size())];
+		getIndex(view["buffer"], this->json["buffers"].size());
+		size_t viewOffset = getSize(view["byteOffset"], 0);
+		size_t viewLength = getSize(view["byteLength"]);
+		size_t offset = getSize(json["byteOffset"], 0);
+		if (viewOffset > binary.size() || viewLength > binary.size() - viewOffset) {
+			fail("buffer view out of range");
+		}
+		// Vertex attributes are aligned to four bytes, even if their elements
+		// are smaller.
+		size_t tightStride = isVertexAttribute ? (result.elementSize + 3) & ~size_t(3) : result.elementSize;
+		result.stride = getSize(view["byteStride"], tightStride);
+		if (result.stride < result.elementSize || (viewOffset + offset) % componentSize != 0 ||
+		    result.stride % componentSize != 0) {
+			fail("misaligned accessor");
+		}
+		if (offset > viewLength || result.count - 1 > (viewLength - offset - result.elementSize) / result.stride ||
+		    result.elementSize > viewLength - offset) {
+			fail("accessor out of range");
+		}
+		result.data = binary.data() + viewOffset + offset;
+		return result;
+	}
+
+	void readPrimitive(JsonValue const &primitive, glm::mat4 const &matrix)
+	{
+		JsonValue const &attributes = primitive["attributes"];
+		if (attributes["POSITION"].isNull()) {
+			fail("primitive without positions");
+		}
+		Accessor positions = getAccessor(attributes["POSITION"], true);
+		std::optional<Accessor> normals;
+		if (!attributes["NORMAL"].isNull()) {
+			normals = getAccessor(attributes["NORMAL"], true);
+		}
+		std::optional<Accessor> indices;
+		if (!primitive["indices"].isNull()) {
+			indices = getAccessor(primitive["indices"], false);
+		}
+
+		if (positions.componentCount != 3 || positions.componentType == GL_UNSIGNED_INT ||
+		    (normals && (normals->componentCount != 3 || normals->count != positions.count ||
+		                 normals->componentType == GL_UNSIGNED_INT))) {
+			fail("unsupported vertex attribute format");
+		}
+		if (indices) {
+			if (indices->componentCount != 1 || indices->stride != indices->elementSize ||
+			    indices->componentType == GL_BYTE || indices->componentType == GL_SHORT ||
+			    indices->componentType == GL_FLOAT || indices->count % 3 != 0) {
+				fail("invalid indices");
+			}
+			for (size_t i = 0; i < indices->count; ++i) {
+				if (readIndex(*indices, i) >= positions.count) {
+					fail("index out of range");
+				}
+			}
+		} else if (positions.count % 3 != 0) {
+			fail("incomplete triangle");
+		}
+
+		GlbPrimitive result;
+		result.transform = matrix;
+		result.bounds = getBounds(positions);
+		// The first entry of the table is the default material.
+		uint32_t material = 0;
+		if (!primitive["material"].isNull()) {
+			material = static_cast<uint32_t>(getIndex(primitive["material"], model.materials.size() - 1) + 1);
+		}
+
+		// Missing normals have to be generated, and OpenGL cannot draw with
+		// byte indices efficiently on every driver.
+		if (!normals || (indices && indices->componentType == GL_UNSIGNED_BYTE)) {
+			result.converted = convert(positions, normals, indices, material);
+		} else {
+			char const *begin = std::min(positions.data, normals->data);
+			char const *end = std::max(positions.end(), normals->end());
+			result.vertices = {begin, static_cast<size_t>(end - begin)};
+			result.vertexCount = positions.count;
+			result.layout.position = getAttribute(positions, begin);
+			result.layout.normal = getAttribute(*normals, begin);
+			result.layout.perVertexMaterial = false;
+			result.layout.constantMaterial = material;
+			if (indices) {
+				result.indices = {indices->data, indices->count * indices->elementSize};
+				result.indexCount = indices->count;
+				result.indexType = indices->componentType;
+			}
+		}
+		model.primitives.push_back(std::move(result));
+	}
+
+	static VertexAttribute getAttribute(Accessor const &accessor, char const *base)
+	{
+		VertexAttribute attribute;
+		attribute.size = accessor.componentCount;
+		attribute.type = accessor.componentType;
+		attribute.normalized = accessor.normalized;
+		attribute.stride = static_cast<GLsizei>(accessor.stride);
+		attribute.offset = static_cast<size_t>(accessor.data - base);
+		return attribute;
+	}
+
+	// Uses the minimum and maximum of the accessor, which are required for
+	// positions, and only reads the positions if they are missing. The sphere
+	// is the one around the box, so no vertex has to be read.
+	static Bounds getBounds(Accessor const &positions)
+	{
+		Bounds result;
+		JsonValue const &min = (*positions.json)["min"];
+		JsonValue const &max = (*positions.json)["max"];
+		if (min.size() == 3 && max.size() == 3 && positions.componentType == GL_FLOAT) {
+			for (int k = 0; k < 3; ++k) {
+				result.min[k] = static_cast<float>(min[k].asNumber());
+				result.max[k] = static_cast<float>(max[k].asNumber());
+			}
+		} else {
+			for (size_t i = 0; i < positions.count; ++i) {
+				glm::vec3 position = readVector3(positions, i);
+				result.min = glm::min(result.min, position);
+				result.max = glm::max(result.max, position);
+			}
+		}
+		result.center = (result.min + result.max) * 0.5f;
+		result.radius = glm::length(result.max - result.min) * 0.5f;
+		return result;
+	}
+
+	// Converts the primitive to the Vertex layout and optimizes it, see
+	// optimizeMesh. Missing normals are flat, as the specification requires.
+	static MeshData convert(
+		Accessor const &positions,
+		std::optional<Accessor> const &normals,
+		std::optional<Accessor> const &indices,
+		uint32_t material)
+	{
+		// Both lists begin with a dummy value, like in the OBJ parser.
+		std::vector<glm::vec3> positionList(1);
+		std::vector<glm::vec3> normalList(1);
+		positionList.reserve(positions.count + 1);
+		for (size_t i = 0; i < positions.count; ++i) {
+			positionList.push_back(readVector3(positions, i));
+		}
+		if (normals) {
+			normalList.reserve(normals->count + 1);
+			for (size_t i = 0; i < normals->count; ++i) {
+				normalList.push_back(readVector3(*normals, i));
+			}
+		}
+
+		TriangleList triangles;
+		size_t cornerCount = indices ? indices->count : positions.count;
+		triangles.corners.reserve(cornerCount);
+		for (size_t i = 0; i < cornerCount; ++i) {
+			size_t index = (indices ? readIndex(*indices, i) : i) + 1;
+			triangles.corners.push_back({index, normals ? index : 0});
+		}
+		triangles.materials.assign(cornerCount / 3, material);
+		triangles.smoothingGroups.assign(cornerCount / 3, 0);
+		generateNormals(triangles, positionList, normalList, 0.0f, 1);
+
+		MeshBuilder builder(cornerCount);
+		for (Corner const &corner: triangles.corners) {
+			MeshBuilder::Key key;
+			key.position = static_cast<uint32_t>(corner.position);
+			key.normal = static_cast<uint32_t>(corner.normal);
+			key.material = material;
+			builder.addCorner(key, [&] {
+				return Vertex {positionList[corner.position], normalList[corner.normal], material};
+			});
+		}
+		MeshData mesh = builder.finish();
+		optimizeMesh(mesh);
+		return mesh;
+	}
+};
+
+bool isGlbFile(std::filesystem::path const &path)
+{
+	return path.extension() == ".glb";
+}
+
+GlbModel readGlbFile(std::filesystem::path const &path)
+{
+	GlbModel model {MappedFile(path), {}, {}};
+	GlbReader reader(path, model);
+	reader.read();
+	return model;
+}
+
+Model loadGlbFile(std::filesystem::path const &path)
+{
+	GlbModel glb = readGlbFile(path);
+	Model model;
+	for (GlbPrimitive const &primitive: glb.primitives) {
+		std::optional<Mesh> mesh;
+		if (primitive.converted) {
+			mesh.emplace(model.geometry, *primitive.converted);
+		} else {
+			mesh.emplace(model.geometry, primitive.vertices.data(), primitive.vertices.size(),
+			             primitive.vertexCount, primitive.layout, nullptr, primitive.indices.data(),
+			             primitive.indexCount, primitive.indexType, primitive.bounds);
+		}
+		mesh->setModelMatrix(primitive.transform);
+		model.addMesh(std::move(*mesh));
+	}
+	model.materials.upload(glb.materials);
+	return model;
+}
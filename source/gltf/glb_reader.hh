@@ -0,0 +1,52 @@
+#pragma once
+
+#include <vector>
+#include <optional>
+#include <filesystem>
+#include <string_view>
+#include <glm/glm.hpp>
+#include "model.hh"
+#include "vertex_layout.hh"
+#include "obj_parser/mapped_file.hh"
+#include "obj_parser/mesh_data.hh"
+
+// Loader for binary glTF 2.0 files (.glb) whose buffers are stored in the
+// file itself. Only triangle primitives with positions and optional normals
+// are used, and each one becomes a separate mesh for every node that refers
+// to it. Materials only contribute their base color factor.
+
+// One primitive of the scene. If its attributes are stored in a format that
+// OpenGL can read, vertices and indices point into the mapped file and can be
+// uploaded as they are, with the given layout. Otherwise, the primitive is
+// converted into a mesh with the usual Vertex layout.
+struct GlbPrimitive {
+	std::string_view vertices;
+	size_t vertexCount {0};
+	VertexLayout layout;
+	// Empty if the primitive is not indexed.
+	std::string_view indices;
+	size_t indexCount {0};
+	GLenum indexType {GL_UNSIGNED_INT};
+	std::optional<MeshData> converted;
+	// In the space of the primitive.
+	Bounds bounds;
+	glm::mat4 transform {1.0f};
+};
+
+struct GlbModel {
+	MappedFile file;
+	std::vector<GlbPrimitive> primitives;
+	// The first material is used by primitives without one.
+	std::vector<Material> materials;
+};
+
+// Returns true if the file name ends in .glb.
+[[nodiscard]] bool isGlbFile(std::filesystem::path const &path);
+
+// Maps the file and validates every accessor that is used, including the
+// values of the indices, so that nothing is read outside of the buffer later.
+// Throws if the file is malformed or requires unsupported features.
+GlbModel readGlbFile(std::filesystem::path const &path);
+
+// Reads the file and uploads every primitive to the GPU.
+Model loadGlbFile(std::filesystem::path const &path);
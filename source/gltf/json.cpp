@@ -0,0 +1,230 @@
+#include <cctype>
+#include <cstdint>
+#include <charconv>
+#include <algorithm>
+#include "json.hh"
+#include "util.hh"
+
+// Recursive descent parser for JSON text as defined by RFC 8259.
+class JsonParser {
+	// Limits the recursion on deeply nested input.
+	static constexpr int MAX_DEPTH = 128;
+
+	std::string_view text;
+	size_t position {0};
+public:
+	explicit JsonParser(std::string_view text) noexcept
+		: text(text)
+	{
+	}
+
+	JsonValue parse()
+	{
+		JsonValue result = parseValue(0);
+		skipWhitespace();
+		if (position != text.size()) {
+			fail();
+		}
+		return result;
+	}
+
+private:
+	[[noreturn]] void fail() const
+	{
+		util::fatalError("Invalid JSON at offset ", std::to_string(position));
+	}
+
+	void skipWhitespace() noexcept
+	{
+		while (position < text.size() &&
+		       (text[position] == ' ' || text[position] == '\t' || text[position] == '\n' || text[position] == '\r')) {
+			++position;
+		}
+	}
+
+	// Skips whitespace and consumes c if it comes next.
+	bool consume(char c) noexcept
+	{
+		skipWhitespace();
+		if (position < text.size() && text[position] == c) {
+			++position;
+			return true;
+		}
+		return false;
+	}
+
+	void expect(char c)
+	{
+		if (!consume(c)) {
+			fail();
+		}
+	}
+
+	bool consumeWord(std::string_view word) noexcept
+	{
+		if (text.substr(position, word.size()) == word) {
+			position += word.size();
+			return true;
+		}
+		return false;
+	}
+
+	JsonValue parseValue(int depth)
+	{
+		if (depth > MAX_DEPTH) {
+			fail();
+		}
+		skipWhitespace();
+		if (position == text.size()) {
+			fail();
+		}
+
+		JsonValue value;
+		char c = text[position];
+		if (c == '{') {
+			++position;
+			value.type = JsonValue::OBJECT;
+			if (!consume('}')) {
+				do {
+					skipWhitespace();
+					value.names.push_back(parseString());
+					expect(':');
+					value.elements.push_back(parseValue(depth + 1));
+				} while (consume(','));
+				expect('}');
+			}
+		} else if (c == '[') {
+			++position;
+			value.type = JsonValue::ARRAY;
+			if (!consume(']')) {
+				do {
+					value.elements.push_back(parseValue(depth + 1));
+				} while (consume(','));
+				expect(']');
+			}
+		} else if (c == '"') {
+			value.type = JsonValue::STRING;
+			value.string = parseString();
+		} else if (consumeWord("true")) {
+			value.type = JsonValue::BOOLEAN;
+			value.boolean = true;
+		} else if (consumeWord("false")) {
+			value.type = JsonValue::BOOLEAN;
+		} else if (consumeWord("null")) {
+			value.type = JsonValue::NUL;
+		} else {
+			value.type = JsonValue::NUMBER;
+			value.number = parseNumber();
+		}
+		return value;
+	}
+
+	double parseNumber()
+	{
+		// from_chars accepts a few things that JSON does not, such as "inf",
+		// so the characters are checked first.
+		size_t end = position;
+		while (end < text.size() && (std::isdigit(static_cast<unsigned char>(text[end])) || text[end] == '-' ||
+		                             text[end] == '+' || text[end] == '.' || text[end] == 'e' || text[end] == 'E')) {
+			++end;
+		}
+		double result = 0.0;
+		auto [next, error] = std::from_chars(text.data() + position, text.data() + end, result);
+		if (error != std::errc() || next != text.data() + end || end == position) {
+			fail();
+		}
+		position = end;
+		return result;
+	}
+
+	std::string parseString()
+	{
+		if (position == text.size() || text[position] != '"') {
+			fail();
+		}
+		++position;
+
+		std::string result;
+		while (true) {
+			if (position == text.size() || static_cast<unsigned char>(text[position]) < 0x20) {
+				fail();
+			}
+			char c = text[position++];
+			if (c == '"') {
+				return result;
+			}
+			if (c != '\\') {
+				result += c;
+				continue;
+			}
+			if (position == text.size()) {
+				fail();
+			}
+			switch (text[position++]) {
+			case '"': result += '"'; break;
+			case '\\': result += '\\'; break;
+			case '/': result += '/'; break;
+			case 'b': result += '\b'; break;
+			case 'f': result += '\f'; break;
+			case 'n': result += '\n'; break;
+			case 'r': result += '\r'; break;
+			case 't': result += '\t'; break;
+			case 'u': appendUtf8(result, parseCodePoint()); break;
+			default: fail();
+			}
+		}
+	}
+
+	uint32_t parseHex4()
+	{
+		uint32_t result = 0;
+		auto [next, error] = std::from_chars(text.data() + position, text.data() + std::min(text.size(), position + 4),
+		                                     result, 16);
+		if (error != std::errc() || next != text.data() + position + 4) {
+			fail();
+		}
+		position += 4;
+		return result;
+	}
+
+	// Combines surrogate pairs into a single code point.
+	uint32_t parseCodePoint()
+	{
+		uint32_t high = parseHex4();
+		if (high < 0xD800 || high > 0xDBFF) {
+			return high;
+		}
+		if (!consumeWord("\\u")) {
+			fail();
+		}
+		uint32_t low = parseHex4();
+		if (low < 0xDC00 || low > 0xDFFF) {
+			fail();
+		}
+		return 0x10000 + ((high - 0xD800) << 10) + (low - 0xDC00);
+	}
+
+	static void appendUtf8(std::string &out, uint32_t c)
+	{
+		if (c < 0x80) {
+			out += static_cast<char>(c);
+		} else if (c < 0x800) {
+			out += static_cast<char>(0xC0 | (c >> 6));
+			out += static_cast<char>(0x80 | (c & 0x3F));
+		} else if (c < 0x10000) {
+			out += static_cast<char>(0xE0 | (c >> 12));
+			out += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+			out += static_cast<char>(0x80 | (c & 0x3F));
+		} else {
+			out += static_cast<char>(0xF0 | (c >> 18));
+			out += static_cast<char>(0x80 | ((c >> 12) & 0x3F));
+			out += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+			out += static_cast<char>(0x80 | (c & 0x3F));
+		}
+	}
+};
+
+JsonValue parseJson(std::string_view text)
+{
+	return JsonParser(text).parse();
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <string_view>
+
+// Minimal read-only JSON document, just enough for the JSON chunk of glTF
+// files. Looking up a missing member or element returns a null value, so
+// optional properties can be read without checking for them first.
+class JsonValue {
+public:
+	enum Type {
+		NUL,
+		BOOLEAN,
+		NUMBER,
+		STRING,
+		ARRAY,
+		OBJECT
+	};
+
+private:
+	Type type {NUL};
+	bool boolean {false};
+	double number {0.0};
+	std::string string;
+	// Elements of an array, or values of the members of an object.
+	std::vector<JsonValue> elements;
+	std::vector<std::string> names;
+
+	friend class JsonParser;
+
+public:
+	[[nodiscard]] Type getType() const noexcept
+	{
+		return type;
+	}
+
+	[[nodiscard]] bool isNull() const noexcept
+	{
+		return type == NUL;
+	}
+
+	[[nodiscard]] bool isNumber() const noexcept
+	{
+		return type == NUMBER;
+	}
+
+	[[nodiscard]] bool isString() const noexcept
+	{
+		return type == STRING;
+	}
+
+	[[nodiscard]] bool isArray() const noexcept
+	{
+		return type == ARRAY;
+	}
+
+	[[nodiscard]] bool isObject() const noexcept
+	{
+		return type == OBJECT;
+	}
+
+	// Number of elements of an array, and zero for everything else.
+	[[nodiscard]] size_t size() const noexcept
+	{
+		return type == ARRAY ? elements.size() : 0;
+	}
+
+	[[nodiscard]] JsonValue const &operator[](size_t index) const noexcept
+	{
+		return type == ARRAY && index < elements.size() ? elements[index] : null();
+	}
+
+	[[nodiscard]] JsonValue const &operator[](std::string_view name) const noexcept
+	{
+		if (type == OBJECT) {
+			for (size_t i = 0; i < names.size(); ++i) {
+				if (names[i] == name) {
+					return elements[i];
+				}
+			}
+		}
+		return null();
+	}
+
+	// The accessors below return the fallback if the value has another type.
+
+	[[nodiscard]] bool asBool(bool fallback = false) const noexcept
+	{
+		return type == BOOLEAN ? boolean : fallback;
+	}
+
+	[[nodiscard]] double asNumber(double fallback = 0.0) const noexcept
+	{
+		return type == NUMBER ? number : fallback;
+	}
+
+	[[nodiscard]] std::string_view asString(std::string_view fallback = {}) const noexcept
+	{
+		return type == STRING ? std::string_view(string) : fallback;
+	}
+
+	// Names of the members of an object, in file order.
+	[[nodiscard]] std::vector<std::string> const &getNames() const noexcept
+	{
+		return names;
+	}
+
+private:
+	static JsonValue const &null() noexcept
+	{
+		static JsonValue const value;
+		return value;
+	}
+};
+
+// Throws if the text is not a single valid JSON value.
+JsonValue parseJson(std::string_view text);
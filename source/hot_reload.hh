@@ -0,0 +1,362 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <thread>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <utility>
+#include <optional>
+#include <exception>
+#include <iostream>
+#include <algorithm>
+#include <filesystem>
+#include "model.hh"
+#include "mesh_loader.hh"
+#include "file_watcher.hh"
+#include "parallel.hh"
+#include "obj_parser/parser.hh"
+#include "obj_parser/mesh_optimizer.hh"
+#include "obj_parser/file_stamp.hh"
+#include "gltf/glb_reader.hh"
+
+// Applies changes of the OBJ files of a loaded model, and of their material
+// libraries, while the model is shown. A worker thread watches the files and
+// parses only the objects that have changed, see IncrementalObjParser. If only
+// a material library has changed, the material table is uploaded again without
+// touching any geometry.
+//
+// update() uploads the new meshes of a change within a budget per frame, like
+// MeshLoader does. Once all of them are on the GPU, they replace the meshes of
+// the file in the model at once, together with the new material table. Files
+// that cannot be parsed are reported, and the model keeps their last version.
+class HotReload {
+	using Clock = std::chrono::steady_clock;
+
+	static constexpr auto POLL_INTERVAL = std::chrono::milliseconds(50);
+
+	// A change of a single file, prepared by the worker thread.
+	struct Change {
+		size_t file {0};
+		// Empty if only the colors of the materials have changed.
+		std::optional<IncrementalObjParser::Result> geometry;
+		// The whole material table of the file.
+		std::vector<Material> materials;
+		Clock::time_point detected;
+	};
+
+	// What the loader has read of a file, to find the changes that it has
+	// missed before the file was watched.
+	struct LoadedState {
+		std::optional<FileStamp> stamp;
+		std::vector<Material> materials;
+	};
+
+	// Where the meshes and materials of a file are in the model.
+	struct FileState {
+		std::filesystem::path path;
+		size_t meshCount {0};
+		std::vector<uint32_t> materialIds;
+	};
+
+	// Shared with the worker thread.
+	std::mutex mutex;
+	std::deque<Change> changes;
+	std::atomic<bool> stopped {false};
+
+	// Only used by the render thread.
+	std::vector<FileState> files;
+	std::vector<Material> table;
+	size_t uploadBudget;
+	bool printStats;
+	std::optional<Change> current;
+	// The new meshes of the current change that have been uploaded so far.
+	std::vector<Mesh> uploaded;
+	size_t nextMesh {0};
+
+	// Only used by the worker thread. Empty for files that are not OBJ files.
+	std::vector<std::optional<IncrementalObjParser>> parsers;
+
+	// Runs watch(), and is started once everything else has been initialized.
+	std::thread worker;
+public:
+	// Takes the files and the material table from a MeshLoader that has
+	// finished. If printStats is true, every reload is printed with the number
+	// of meshes that have changed and the time it took.
+	HotReload(
+		std::vector<MeshLoader::LoadedFile> const &loadedFiles,
+		std::vector<Material> materials,
+		bool printStats = false,
+		size_t uploadBudget = 4 << 20)
+		: table(std::move(materials)), uploadBudget(uploadBudget), printStats(printStats)
+	{
+		std::vector<LoadedState> loaded;
+		for (auto const &file: loadedFiles) {
+			files.push_back({file.path, file.meshCount, file.materialIds});
+			loaded.push_back({file.stamp, {}});
+			for (uint32_t id: file.materialIds) {
+				loaded.back().materials.push_back(table[id]);
+			}
+			if (isGlbFile(file.path)) {
+				parsers.emplace_back();
+			} else {
+				parsers.emplace_back(file.path);
+			}
+		}
+		worker = std::thread([this, loaded = std::move(loaded)] {
+			try {
+				watch(loaded);
+			} catch (std::string &message) {
+				std::cout << "Could not watch files: " << message << '\n';
+			}
+		});
+	}
+
+	HotReload(HotReload const &) = delete;
+
+	HotReload &operator=(HotReload const &) = delete;
+
+	// Waits for the worker thread, which may have to finish a parse first.
+	~HotReload()
+	{
+		stopped = true;
+		worker.join();
+	}
+
+	// Uploads new meshes until the budget is used up, and applies the changes
+	// that are complete to the model.
+	void update(Model &model)
+	{
+		size_t budget = uploadBudget;
+		while (true) {
+			if (!current) {
+				std::lock_guard lock(mutex);
+				if (changes.empty()) {
+					return;
+				}
+				current = std::move(changes.front());
+				changes.pop_front();
+				uploaded.clear();
+				nextMesh = 0;
+			}
+
+			std::vector<uint32_t> ids = getMaterialIds(*current);
+			if (current->geometry) {
+				auto &meshes = current->geometry->meshes;
+				for (; nextMesh < meshes.size() && budget > 0; ++nextMesh) {
+					MeshData &data = meshes[nextMesh].data;
+					if (meshes[nextMesh].previous) {
+						continue;
+					}
+					// Growing the arena is charged like uploads, see
+					// MeshLoader::update.
+					GLenum indexType = data.vertices.size() <= UINT16_MAX + 1 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+					size_t growthCost = model.geometry->getGrowthCost(data.vertices.size(), data.indices.size(),
+					                                                  indexType);
+					if (growthCost > budget && budget < uploadBudget) {
+						return;
+					}
+					for (Vertex &vertex: data.vertices) {
+						vertex.material = ids[vertex.material];
+					}
+					uploaded.emplace_back(model.geometry, data);
+					size_t size = data.vertices.size() * (sizeof(PackedVertex) + sizeof(PackedPosition) +
+					                                      sizeof(uint32_t)) +
+					              data.indices.size() * sizeof(uint32_t) + growthCost;
+					budget -= std::min(budget, size);
+					data = {};
+				}
+				if (nextMesh < meshes.size()) {
+					return;
+				}
+			}
+			apply(model, std::move(ids));
+			current.reset();
+		}
+	}
+
+private:
+	// Index in the table of every material of the change. Materials that the
+	// file did not have before are appended to the table.
+	[[nodiscard]] std::vector<uint32_t> getMaterialIds(Change const &change) const
+	{
+		std::vector<uint32_t> ids = files[change.file].materialIds;
+		ids.resize(std::min(ids.size(), change.materials.size()));
+		while (ids.size() < change.materials.size()) {
+			ids.push_back(static_cast<uint32_t>(table.size() + ids.size() - files[change.file].materialIds.size()));
+		}
+		return ids;
+	}
+
+	void apply(Model &model, std::vector<uint32_t> &&ids)
+	{
+		FileState &file = files[current->file];
+		for (size_t i = 0; i < ids.size(); ++i) {
+			if (ids[i] == table.size()) {
+				table.push_back(current->materials[i]);
+			} else {
+				table[ids[i]] = current->materials[i];
+			}
+		}
+		if (ids.size() > file.materialIds.size()) {
+			file.materialIds = std::move(ids);
+		}
+		model.materials.upload(table);
+
+		if (!current->geometry) {
+			return;
+		}
+		size_t begin = 0;
+		for (size_t i = 0; i < current->file; ++i) {
+			begin += files[i].meshCount;
+		}
+		std::vector<Mesh> meshes;
+		auto next = uploaded.begin();
+		size_t changedCount = 0;
+		for (auto const &mesh: current->geometry->meshes) {
+			if (mesh.previous) {
+				meshes.push_back(std::move(model.meshes[begin + *mesh.previous]));
+			} else {
+				meshes.push_back(std::move(*next++));
+				++changedCount;
+			}
+		}
+		uploaded.clear();
+		model.replaceMeshes(begin, file.meshCount, std::move(meshes));
+		file.meshCount = current->geometry->meshes.size();
+
+		if (!printStats) {
+			return;
+		}
+		auto milliseconds = std::chrono::duration<double, std::milli>(Clock::now() - current->detected).count();
+		std::cout << "Reloaded " << file.path << ": " << changedCount << " of "
+		          << file.meshCount << " meshes changed, " << milliseconds << " ms\n";
+	}
+
+	void watch(std::vector<LoadedState> const &loaded)
+	{
+		// Leave one hardware thread to the render loop.
+		unsigned threadCount = std::max(1u, util::hardwareThreadCount() - 1);
+		FileWatcher watcher;
+		std::map<std::filesystem::path, size_t> objFiles;
+		std::map<std::filesystem::path, std::vector<size_t>> dependents;
+
+		auto watchLibraries = [&](size_t i) {
+			for (auto const &library: parsers[i]->getLibraries()) {
+				auto &users = dependents[normalize(library)];
+				if (std::find(users.begin(), users.end(), i) == users.end()) {
+					watcher.watch(normalize(library));
+					users.push_back(i);
+				}
+			}
+		};
+
+		// Changes are detected from here on. Files that are the same as when
+		// they were loaded are only scanned for their objects, whose meshes
+		// the loader has uploaded already. Others are parsed as if they had
+		// changed, and so are their materials if only those have changed.
+		for (size_t i = 0; i < parsers.size(); ++i) {
+			if (parsers[i]) {
+				objFiles[normalize(parsers[i]->getPath())] = i;
+				watcher.watch(normalize(parsers[i]->getPath()));
+			}
+		}
+		for (size_t i = 0; i < parsers.size() && !stopped; ++i) {
+			if (parsers[i]) {
+				Clock::time_point detected = Clock::now();
+				tryReload(i, [&] {
+					std::optional<FileStamp> const &stamp = loaded[i].stamp;
+					if (!stamp || !isUpToDate(*stamp, parsers[i]->getPath())) {
+						push(i, parsers[i]->parse(threadCount), detected, threadCount);
+						return;
+					}
+					std::vector<Material> materials = parsers[i]->scan(threadCount);
+					if (!isSame(materials, loaded[i].materials)) {
+						std::lock_guard lock(mutex);
+						changes.push_back({i, std::nullopt, std::move(materials), detected});
+					}
+				});
+				watchLibraries(i);
+			}
+		}
+
+		while (!stopped) {
+			std::this_thread::sleep_for(POLL_INTERVAL);
+			Clock::time_point detected = Clock::now();
+			std::vector<std::filesystem::path> changed = watcher.poll();
+			std::vector<size_t> reloaded;
+			for (auto const &path: changed) {
+				auto file = objFiles.find(path);
+				if (file != objFiles.end()) {
+					size_t i = file->second;
+					tryReload(i, [&] {
+						push(i, parsers[i]->parse(threadCount), detected, threadCount);
+					});
+					watchLibraries(i);
+					reloaded.push_back(i);
+				}
+			}
+			// Files that have been parsed again have read their libraries
+			// already.
+			for (auto const &path: changed) {
+				auto library = dependents.find(path);
+				if (library == dependents.end()) {
+					continue;
+				}
+				for (size_t i: library->second) {
+					if (std::find(reloaded.begin(), reloaded.end(), i) == reloaded.end()) {
+						tryReload(i, [&] {
+							std::vector<Material> materials = parsers[i]->reloadMaterials();
+							std::lock_guard lock(mutex);
+							changes.push_back({i, std::nullopt, std::move(materials), detected});
+						});
+						reloaded.push_back(i);
+					}
+				}
+			}
+		}
+	}
+
+	template<typename Reload>
+	void tryReload(size_t file, Reload const &reload)
+	{
+		try {
+			reload();
+		} catch (std::string &message) {
+			std::cout << "Could not reload " << parsers[file]->getPath() << ": " << message << '\n';
+		} catch (std::exception &exception) {
+			std::cout << "Could not reload " << parsers[file]->getPath() << ": " << exception.what() << '\n';
+		}
+	}
+
+	// Optimizes the meshes that have changed, like MeshLoader does. Copies of
+	// other meshes are optimized on their own, so their triangles can be in a
+	// different order than after loading, which only matters for instancing.
+	void push(size_t file, IncrementalObjParser::Result &&result, Clock::time_point detected, unsigned threadCount)
+	{
+		util::parallelFor(result.meshes.size(), threadCount, [&](size_t i) {
+			if (!result.meshes[i].previous) {
+				optimizeMesh(result.meshes[i].data);
+			}
+		});
+		std::vector<Material> materials = std::move(result.materials);
+		std::lock_guard lock(mutex);
+		changes.push_back({file, std::move(result), std::move(materials), detected});
+	}
+
+	static bool isSame(std::vector<Material> const &a, std::vector<Material> const &b)
+	{
+		return std::equal(a.begin(), a.end(), b.begin(), b.end(), [](Material const &x, Material const &y) {
+			return x.diffuse == y.diffuse;
+		});
+	}
+
+	static std::filesystem::path normalize(std::filesystem::path const &path)
+	{
+		return std::filesystem::absolute(path).lexically_normal();
+	}
+};
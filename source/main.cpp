@@ -5,11 +5,15 @@
 #include <imgui_impl_opengl3.h>
 #include <iostream>
 #include <cstdlib>
+#include <optional>
+#include <string_view>
 #include "program.hh"
 #include "mesh.hh"
 #include "camera.hh"
-#include "obj_parser/parser.hh"
+#include "mesh_loader.hh"
+#include "hot_reload.hh"
 #include "shadowmap.hh"
+#include "fragment_counter.hh"
 
 void onGlfwError(int code, char const *description)
 {
@@ -60,6 +64,10 @@ public:
 };
 
 class Application {
+	static constexpr GLuint MATERIALS_BINDING {0};
+	// Texture unit 0 holds the shadow map.
+	static constexpr int DRAW_DATA_UNIT {1};
+
 	int winWidth {1260};
 	int winHeight {750};
 	Context window {winWidth, winHeight, "Shadow Mapping"};
@@ -67,7 +75,19 @@ class Application {
 	Camera camera {glm::vec3(9.0f, 9.5f, 8.5f), glm::vec3(0.0f)};
 	Camera *activeCamera {&camera};
 	Program normalPass {"source/shaders/normalPass.vert", "source/shaders/normalPass.frag"};
-	std::vector<Mesh> meshes {loadMeshesFromFile("assets/mammoth.obj")};
+	// Fragments of the normal pass that pass the depth test, see
+	// optimizeOverdraw.
+	FragmentCounter shadedFragments;
+	Model model;
+	MeshLoader loader;
+	bool loading {true};
+	bool watchFiles {false};
+	// Whether load times, vertex quantization errors and reloads are printed.
+	bool printStats {false};
+	// Created once loading has finished.
+	std::optional<HotReload> hotReload;
+	// Longest frame time while meshes were still being uploaded.
+	float longestLoadingFrame {0.0f};
 
 	ShadowMap shadowMap {glm::vec3(-8.0f, 15.0f, 10.0f), glm::vec3(0.0f)};
 
@@ -80,7 +100,18 @@ class Application {
 	bool enablePCSS {true};
 	float lightWidth {0.65f};
 public:
-	Application()
+	// The models can be OBJ files, which may be compressed, or .glb files.
+	// Several of them are shown together. If watchFiles is true, changes of the
+	// OBJ files and their material libraries are shown while running. This
+	// only works if the meshes are grouped by object.
+	Application(
+		std::vector<std::filesystem::path> const &modelPaths,
+		MeshLoader::Grouping grouping,
+		bool watchFiles,
+		bool printStats)
+		: loader(modelPaths, grouping),
+		  watchFiles(watchFiles && grouping == MeshLoader::BY_OBJECT),
+		  printStats(printStats)
 	{
 		glfwSetWindowUserPointer(window, this);
 		glfwSetKeyCallback(window, onKeyInput);
@@ -91,6 +122,8 @@ public:
 			glfwSetInputMode(window, GLFW_RAW_MOUSE_MOTION, true);
 		}
 
+		normalPass.setUniformBlock("Materials", MATERIALS_BINDING);
+
 		// Sets the correct projection matrix.
 		onFramebufferResize(window, winWidth, winHeight);
 
@@ -109,11 +142,18 @@ public:
 		glEnable(GL_CULL_FACE);
 
 		double prevTime = glfwGetTime();
+		bool firstFrame = true;
 		while (!glfwWindowShouldClose(window)) {
 			double time = glfwGetTime();
 			auto deltaTime = (float) (time - prevTime);
 			prevTime = time;
 
+			if (loading) {
+				updateLoading(deltaTime);
+			} else if (hotReload) {
+				hotReload->update(model);
+			}
+
 			if (animateLight) {
 				shadowMap.getCamera().animate(deltaTime);
 			}
@@ -121,14 +161,49 @@ public:
 			glfwPollEvents();
 			handleUserInput(deltaTime);
 
-			shadowMap.renderShadowPass(meshes);
+			model.geometry->uploadDrawData();
+			shadowMap.renderShadowPass(model);
 			renderNormalPass();
 			renderGui(deltaTime);
 			glfwSwapBuffers(window);
+
+			if (firstFrame && printStats) {
+				// glfwGetTime counts from glfwInit.
+				std::cout << "First frame after " << glfwGetTime() * 1000 << " ms\n";
+			}
+			firstFrame = false;
 		}
 	}
 
 private:
+	void updateLoading(float deltaTime)
+	{
+		longestLoadingFrame = std::max(longestLoadingFrame, deltaTime);
+		loading = loader.update(model);
+		if (loading) {
+			return;
+		}
+		if (printStats) {
+			printLoadingStats();
+		}
+		if (watchFiles) {
+			hotReload.emplace(loader.getFiles(), loader.getMaterials(), printStats);
+		}
+	}
+
+	void printLoadingStats() const
+	{
+		size_t instanceCount = 0;
+		for (Mesh const &mesh: model.meshes) {
+			instanceCount += mesh.getInstanceCount();
+		}
+		std::cout << "Loaded " << model.meshes.size() << " meshes with " << instanceCount << " instances after "
+		          << glfwGetTime() << " s, longest frame while loading: " << longestLoadingFrame * 1000 << " ms\n";
+		QuantizationError const &error = loader.getQuantizationError();
+		std::cout << "Vertex quantization error: " << error.position << " (" << error.relativePosition * 100
+		          << "% of the mesh size), normals " << error.normal << " degrees\n";
+	}
+
 	void handleUserInput(float deltaTime)
 	{
 		float const SPEED = 14.0f;
@@ -186,7 +261,7 @@ private:
 		return glfwGetMouseButton(window, button) == GLFW_PRESS;
 	}
 
-	void renderNormalPass() const
+	void renderNormalPass()
 	{
 		glBindFramebuffer(GL_FRAMEBUFFER, 0);
 		glViewport(0, 0, winWidth - panelWidth, winHeight);
@@ -210,11 +285,12 @@ private:
 		normalPass.set("uShadowQuality", shadowQuality);
 		normalPass.set("uFilterRadius", filterRadius);
 		normalPass.set("uEnablePCSS", enablePCSS);
+		normalPass.setTexture("uDrawData", DRAW_DATA_UNIT, model.geometry->getDrawTexture(), GL_TEXTURE_BUFFER);
 
-		for (auto const &mesh: meshes) {
-			normalPass.set("uModel", mesh.getModelMatrix());
-			mesh.drawArrays();
-		}
+		model.materials.bind(MATERIALS_BINDING);
+		shadedFragments.begin();
+		model.draw();
+		shadedFragments.end();
 	}
 
 	void renderGui(float deltaTime)
@@ -269,7 +345,14 @@ private:
 
 		ImGui::Separator();
 
+		if (loading) {
+			ImGui::Text("Loading... %d meshes", int(model.meshes.size()));
+		}
 		ImGui::Text("FPS: %d", int(1.0f / deltaTime));
+		// Overdraw includes the background, which is not shaded.
+		float pixels = float(std::max(1, (winWidth - panelWidth) * winHeight));
+		ImGui::Text("Shaded fragments: %.0fk (%.2f per pixel)", float(shadedFragments.getCount()) / 1000.0f,
+		            float(shadedFragments.getCount()) / pixels);
 		ImGui::Text("Delta time: %f ms", deltaTime * 1000);
 	}
 
@@ -306,10 +389,40 @@ private:
 	}
 };
 
-int main()
+int main(int argc, char **argv)
 {
 	try {
-		Application app;
+		std::vector<std::filesystem::path> modelPaths;
+		bool watchFiles = false;
+		bool printStats = false;
+		std::optional<MeshLoader::Grouping> grouping;
+		for (int i = 1; i < argc; ++i) {
+			if (std::string_view(argv[i]) == "--watch") {
+				watchFiles = true;
+			} else if (std::string_view(argv[i]) == "--stats") {
+				printStats = true;
+			} else if (std::string_view(argv[i]) == "--group-by-object") {
+				grouping = MeshLoader::BY_OBJECT;
+			} else if (std::string_view(argv[i]) == "--group-by-material") {
+				grouping = MeshLoader::BY_MATERIAL;
+			} else if (std::string_view(argv[i]) == "--group-by-geometry") {
+				grouping = MeshLoader::BY_GEOMETRY;
+			} else {
+				modelPaths.emplace_back(argv[i]);
+			}
+		}
+		if (modelPaths.empty()) {
+			modelPaths.emplace_back("assets/mammoth.obj");
+		}
+		// Copies of an object are drawn as instances, unless the files are
+		// watched, which needs a mesh for every object.
+		if (!grouping) {
+			grouping = watchFiles ? MeshLoader::BY_OBJECT : MeshLoader::BY_GEOMETRY;
+		}
+		if (watchFiles && grouping != MeshLoader::BY_OBJECT) {
+			std::cout << "Files are only watched when meshes are grouped by object\n";
+		}
+		Application app(modelPaths, *grouping, watchFiles, printStats);
 		app.enterMainLoop();
 	} catch (std::string &message) {
 		std::cerr << message << '\n';
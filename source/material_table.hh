@@ -0,0 +1,77 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <glad.h>
+#include <glm/glm.hpp>
+#include "obj_parser/material.hh"
+#include "util.hh"
+
+// Uniform buffer with the materials of a model, which vertices refer to by
+// index. The layout matches the Materials block in the shaders.
+class MaterialTable {
+	GLuint ubo {0};
+public:
+	// Must match MAX_MATERIALS in the shaders. 16 KiB is the smallest uniform
+	// block size that every implementation supports.
+	static constexpr size_t MAX_MATERIALS = 1024;
+
+	// The buffer always has room for MAX_MATERIALS, because the whole block
+	// has to be backed by the bound range.
+	MaterialTable()
+	{
+		glGenBuffers(1, &ubo);
+		glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+		glBufferData(GL_UNIFORM_BUFFER, MAX_MATERIALS * sizeof(GpuMaterial), nullptr, GL_STATIC_DRAW);
+	}
+
+	MaterialTable(MaterialTable const &) = delete;
+
+	MaterialTable &operator=(MaterialTable const &) = delete;
+
+	MaterialTable(MaterialTable &&other) noexcept
+	{
+		*this = std::move(other);
+	}
+
+	MaterialTable &operator=(MaterialTable &&other) noexcept
+	{
+		if (this != &other) {
+			glDeleteBuffers(1, &ubo);
+			ubo = std::exchange(other.ubo, 0);
+		}
+		return *this;
+	}
+
+	~MaterialTable() noexcept
+	{
+		glDeleteBuffers(1, &ubo);
+	}
+
+	void upload(std::vector<Material> const &materials)
+	{
+		if (materials.size() > MAX_MATERIALS) {
+			util::fatalError("Too many materials: ", std::to_string(materials.size()));
+		}
+		std::vector<GpuMaterial> data;
+		data.reserve(materials.size());
+		for (auto const &material: materials) {
+			data.push_back({glm::vec4(material.diffuse, 1.0f)});
+		}
+		glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, static_cast<GLsizeiptr>(data.size() * sizeof(GpuMaterial)),
+		                data.data());
+	}
+
+	void bind(GLuint bindingPoint) const noexcept
+	{
+		glBindBufferBase(GL_UNIFORM_BUFFER, bindingPoint, ubo);
+	}
+
+private:
+	// std140 layout of a single material.
+	struct GpuMaterial {
+		glm::vec4 diffuse;
+	};
+};
@@ -1,34 +1,89 @@
 #pragma once
 
+#include <memory>
 #include <vector>
 #include <utility>
+#include <cstdint>
+#include <optional>
 #include <glad.h>
 #include <glm/glm.hpp>
+#include "geometry_arena.hh"
+#include "vertex_layout.hh"
 #include "obj_parser/vertex.hh"
+#include "obj_parser/mesh_data.hh"
 
+// Meshes with packed vertices and indices are stored in the GeometryArena of
+// their model, which draws them together, see Model::draw. Other meshes have
+// their own buffers and are drawn one by one. Either way, their model matrix,
+// position quantization and constant material or material offset are in the
+// draw data of the arena.
+//
+// A mesh can have several instances, which share the geometry but each have a
+// model matrix of their own. They are drawn with a single instanced draw
+// call.
 class Mesh {
+	std::shared_ptr<GeometryArena> arena;
+	uint32_t drawIndex {0};
+	bool inArena {false};
+	GeometryArena::Range range;
+	// Only used by meshes that are not in the arena.
 	GLuint vao {0};
 	GLuint vbo {0};
+	GLuint ebo {0};
+	// Only the positions, for depth-only passes, if the layout is packed.
+	// Otherwise, depth-only passes use the main VAO.
+	GLuint depthVao {0};
+	GLuint positionVbo {0};
 	int vertexCount {-1};
+	Bounds bounds;
+	// One for every instance, with consecutive draw indices.
+	std::vector<glm::mat4> modelMatrices {glm::mat4(1.0f)};
+	int indexCount {0};
+	GLenum indexType {GL_UNSIGNED_INT};
+	// Empty if the material is read from the vertices.
+	std::optional<uint32_t> constantMaterial;
+	uint32_t materialOffset {0};
+	PositionQuantization quantization;
 public:
-	explicit Mesh(std::vector<Vertex> const &vertices)
-		: vertexCount(static_cast<int>(vertices.size()))
+	// The vertices are packed, see PackedVertex. Uses 16-bit indices whenever
+	// all vertices can be addressed with them.
+	Mesh(std::shared_ptr<GeometryArena> geometry, MeshData const &data)
+		: arena(std::move(geometry)), drawIndex(arena->addDraws(1)), bounds(data.bounds)
 	{
-		glGenVertexArrays(1, &vao);
-		glBindVertexArray(vao);
+		if (data.vertices.size() <= UINT16_MAX + 1) {
+			std::vector<uint16_t> shortIndices(data.indices.begin(), data.indices.end());
+			uploadPacked(data.vertices.data(), data.vertices.size(), shortIndices.data(), shortIndices.size(),
+			             GL_UNSIGNED_SHORT);
+		} else {
+			uploadPacked(data.vertices.data(), data.vertices.size(), data.indices.data(), data.indices.size(),
+			             GL_UNSIGNED_INT);
+		}
+	}
 
-		glGenBuffers(1, &vbo);
-		glBindBuffer(GL_ARRAY_BUFFER, vbo);
-		auto totalSize = static_cast<GLsizeiptr>(vertices.size() * sizeof(Vertex));
-		glBufferData(GL_ARRAY_BUFFER, totalSize, vertices.data(), GL_STATIC_DRAW);
+	// indexType must be GL_UNSIGNED_SHORT or GL_UNSIGNED_INT. Without indices,
+	// every three vertices form a triangle. The vertices are packed within the
+	// bounds.
+	Mesh(std::shared_ptr<GeometryArena> geometry, Vertex const *vertices, size_t numVertices, void const *indices,
+	     size_t numIndices, GLenum type, Bounds const &bounds)
+		: arena(std::move(geometry)), drawIndex(arena->addDraws(1)), bounds(bounds)
+	{
+		uploadPacked(vertices, numVertices, indices, numIndices, type);
+	}
 
-		glEnableVertexAttribArray(0);
-		glEnableVertexAttribArray(1);
-		glEnableVertexAttribArray(2);
-		GLsizei stride = sizeof(Vertex);
-		glVertexAttribPointer(0, 3, GL_FLOAT, false, stride, (GLvoid *) offsetof(Vertex, pos));
-		glVertexAttribPointer(1, 3, GL_FLOAT, false, stride, (GLvoid *) offsetof(Vertex, normal));
-		glVertexAttribPointer(2, 3, GL_FLOAT, false, stride, (GLvoid *) offsetof(Vertex, color));
+	// Same as above, but the vertex buffer holds vertexBytes bytes in the given
+	// layout, and positions holds a PackedPosition for every vertex if the
+	// layout is packed. Null pointers only allocate the buffers, which can be
+	// filled later with updateVertices, updatePositions and updateIndices. The
+	// draw indices of a mesh in the arena are only set along with the
+	// vertices, so they have to be set with updateDrawIndices in that case.
+	// All instances have the identity as their model matrix at first.
+	Mesh(std::shared_ptr<GeometryArena> geometry, void const *vertices, size_t vertexBytes, size_t numVertices,
+	     VertexLayout const &layout, void const *positions, void const *indices, size_t numIndices, GLenum type,
+	     Bounds const &bounds, size_t instanceCount = 1)
+		: arena(std::move(geometry)), drawIndex(arena->addDraws(instanceCount)), bounds(bounds),
+		  modelMatrices(instanceCount, glm::mat4(1.0f))
+	{
+		upload(vertices, vertexBytes, numVertices, layout, positions, indices, numIndices, type);
 	}
 
 	Mesh(Mesh const &) = delete;
@@ -43,31 +98,267 @@ public:
 	Mesh &operator=(Mesh &&other) noexcept
 	{
 		if (this != &other) {
-			glDeleteBuffers(1, &vbo);
-			glDeleteVertexArrays(1, &vao);
+			release();
+			arena = std::move(other.arena);
+			drawIndex = other.drawIndex;
+			inArena = std::exchange(other.inArena, false);
+			range = other.range;
+			ebo = std::exchange(other.ebo, 0);
 			vbo = std::exchange(other.vbo, 0);
 			vao = std::exchange(other.vao, 0);
+			positionVbo = std::exchange(other.positionVbo, 0);
+			depthVao = std::exchange(other.depthVao, 0);
 			vertexCount = std::exchange(other.vertexCount, -1);
+			bounds = other.bounds;
+			modelMatrices = std::move(other.modelMatrices);
+			indexCount = std::exchange(other.indexCount, 0);
+			indexType = other.indexType;
+			constantMaterial = other.constantMaterial;
+			materialOffset = other.materialOffset;
+			quantization = other.quantization;
 		}
 		return *this;
 	}
 
 	~Mesh() noexcept
 	{
-		glDeleteBuffers(1, &vbo);
-		glDeleteVertexArrays(1, &vao);
+		release();
+	}
+
+	[[nodiscard]] size_t getInstanceCount() const noexcept
+	{
+		return modelMatrices.size();
+	}
+
+	[[nodiscard]] glm::mat4 const &getModelMatrix(size_t instance = 0) const noexcept
+	{
+		return modelMatrices[instance];
+	}
+
+	void setModelMatrix(glm::mat4 const &matrix, size_t instance = 0)
+	{
+		modelMatrices[instance] = matrix;
+		setDraw(instance);
+	}
+
+	// Bounds of the vertices in model space.
+	[[nodiscard]] Bounds const &getBounds() const noexcept
+	{
+		return bounds;
 	}
 
-	[[nodiscard]] glm::mat4 const &getModelMatrix() const noexcept
+	// Bounds of all instances in world space.
+	[[nodiscard]] Bounds getWorldBounds() const noexcept
 	{
-		// Implemented for future use.
-		static constexpr glm::mat4 modelMatrix(1.0f);
-		return modelMatrix;
+		Bounds result;
+		for (glm::mat4 const &matrix: modelMatrices) {
+			result = mergeBounds(result, transformBounds(bounds, matrix));
+		}
+		return result;
 	}
 
-	void drawArrays() const noexcept
+	// Whether a mesh with this layout is stored in the arena. The arena only
+	// holds indexed meshes, which all meshes from the parser are.
+	[[nodiscard]] static bool isStoredInArena(VertexLayout const &layout, size_t numIndices) noexcept
 	{
+		return layout.packedVertices && numIndices > 0;
+	}
+
+	// Index of the draw data of the first instance in the arena.
+	[[nodiscard]] uint32_t getDrawIndex() const noexcept
+	{
+		return drawIndex;
+	}
+
+	// Whether the geometry is stored in the arena, at getRange().
+	[[nodiscard]] bool isInArena() const noexcept
+	{
+		return inArena;
+	}
+
+	[[nodiscard]] GeometryArena::Range const &getRange() const noexcept
+	{
+		return range;
+	}
+
+	// Overwrites part of the vertex buffer. Offset and size are in bytes.
+	void updateVertices(size_t offset, void const *data, size_t size) const noexcept
+	{
+		if (inArena) {
+			arena->updateVertices(range, offset, data, size);
+			return;
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		glBufferSubData(GL_ARRAY_BUFFER, static_cast<GLintptr>(offset), static_cast<GLsizeiptr>(size), data);
+	}
+
+	// Overwrites part of the position stream. Offset and size are in bytes.
+	void updatePositions(size_t offset, void const *data, size_t size) const noexcept
+	{
+		if (inArena) {
+			arena->updatePositions(range, offset, data, size);
+			return;
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, positionVbo);
+		glBufferSubData(GL_ARRAY_BUFFER, static_cast<GLintptr>(offset), static_cast<GLsizeiptr>(size), data);
+	}
+
+	// Sets part of the draw indices of the vertices, if the mesh is in the
+	// arena. Offset and size are in bytes, four per vertex.
+	void updateDrawIndices(size_t offset, size_t size) const
+	{
+		if (inArena) {
+			arena->updateDrawIndices(range, offset, size, drawIndex);
+		}
+	}
+
+	// Overwrites part of the index buffer. Offset and size are in bytes.
+	void updateIndices(size_t offset, void const *data, size_t size) const noexcept
+	{
+		if (inArena) {
+			arena->updateIndices(range, offset, data, size);
+			return;
+		}
+		// Binding an element buffer changes the state of the bound VAO.
+		glBindVertexArray(vao);
+		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, static_cast<GLintptr>(offset), static_cast<GLsizeiptr>(size),
+		                data);
+	}
+
+	// Draws all instances of only this mesh. Model::draw draws all meshes in
+	// the arena with a single instance at once.
+	void draw() const noexcept
+	{
+		glBindVertexArray(inArena ? arena->getVao() : vao);
+		drawTriangles();
+	}
+
+	// Only provides the position attribute, for passes that only write the
+	// depth.
+	void drawDepth() const noexcept
+	{
+		if (inArena) {
+			glBindVertexArray(arena->getDepthVao());
+		} else {
+			glBindVertexArray(depthVao ? depthVao : vao);
+		}
+		drawTriangles();
+	}
+
+private:
+	void drawTriangles() const noexcept
+	{
+		auto instanceCount = static_cast<GLsizei>(modelMatrices.size());
+		if (inArena) {
+			glDrawElementsInstancedBaseVertex(GL_TRIANGLES, indexCount, indexType, (GLvoid *) range.indexOffset,
+			                                  instanceCount, static_cast<GLint>(range.baseVertex));
+			return;
+		}
+		// Vertex attribute values are not part of the VAO state, so the draw
+		// index has to be set before every draw call.
+		glVertexAttribI1ui(GeometryArena::DRAW_LOCATION, drawIndex);
+		if (ebo) {
+			glDrawElementsInstanced(GL_TRIANGLES, indexCount, indexType, nullptr, instanceCount);
+		} else {
+			glDrawArraysInstanced(GL_TRIANGLES, 0, vertexCount, instanceCount);
+		}
+	}
+
+	void setDraw(size_t instance)
+	{
+		arena->setDraw(static_cast<uint32_t>(drawIndex + instance), modelMatrices[instance], quantization,
+		               constantMaterial, materialOffset);
+	}
+
+	void uploadPacked(Vertex const *vertices, size_t numVertices, void const *indices, size_t numIndices, GLenum type)
+	{
+		std::vector<PackedVertex> packed = packVertices(vertices, numVertices,
+		                                                PositionQuantization::fromBounds(bounds));
+		std::vector<PackedPosition> positions = packPositions(packed.data(), packed.size());
+		upload(packed.data(), packed.size() * sizeof(PackedVertex), numVertices, VertexLayout::packed(bounds),
+		       positions.data(), indices, numIndices, type);
+	}
+
+	void upload(void const *vertices, size_t vertexBytes, size_t numVertices, VertexLayout const &layout,
+	            void const *positions, void const *indices, size_t numIndices, GLenum type)
+	{
+		vertexCount = static_cast<int>(numVertices);
+		if (!layout.perVertexMaterial) {
+			constantMaterial = layout.constantMaterial;
+		}
+		materialOffset = layout.materialOffset;
+		quantization = layout.quantization;
+		for (size_t i = 0; i < modelMatrices.size(); ++i) {
+			setDraw(i);
+		}
+		indexCount = static_cast<int>(numIndices);
+		indexType = type;
+		size_t indexSize = type == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t);
+
+		if (isStoredInArena(layout, numIndices)) {
+			inArena = true;
+			range = arena->allocate(numVertices, numIndices, type);
+			if (vertices) {
+				arena->updateVertices(range, 0, vertices, vertexBytes);
+				arena->updateDrawIndices(range, 0, numVertices * sizeof(uint32_t), drawIndex);
+			}
+			if (positions) {
+				arena->updatePositions(range, 0, positions, numVertices * sizeof(PackedPosition));
+			}
+			if (indices) {
+				arena->updateIndices(range, 0, indices, numIndices * indexSize);
+			}
+			return;
+		}
+
+		glGenVertexArrays(1, &vao);
 		glBindVertexArray(vao);
-		glDrawArrays(GL_TRIANGLES, 0, vertexCount);
+
+		glGenBuffers(1, &vbo);
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		glBufferData(GL_ARRAY_BUFFER, static_cast<GLsizeiptr>(vertexBytes), vertices, GL_STATIC_DRAW);
+
+		if (numIndices > 0) {
+			// The element buffer binding is part of the VAO state.
+			glGenBuffers(1, &ebo);
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, static_cast<GLsizeiptr>(numIndices * indexSize), indices,
+			             GL_STATIC_DRAW);
+		}
+
+		setVertexAttribute(GeometryArena::POSITION_LOCATION, layout.position);
+		setVertexAttribute(GeometryArena::NORMAL_LOCATION, layout.normal);
+		if (layout.perVertexMaterial) {
+			setIntegerVertexAttribute(GeometryArena::MATERIAL_LOCATION, layout.material);
+		}
+
+		if (layout.packedVertices) {
+			glGenVertexArrays(1, &depthVao);
+			glBindVertexArray(depthVao);
+			glGenBuffers(1, &positionVbo);
+			glBindBuffer(GL_ARRAY_BUFFER, positionVbo);
+			glBufferData(GL_ARRAY_BUFFER, static_cast<GLsizeiptr>(numVertices * sizeof(PackedPosition)), positions,
+			             GL_STATIC_DRAW);
+			if (ebo) {
+				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+			}
+			setVertexAttribute(GeometryArena::POSITION_LOCATION,
+			                   {3, GL_UNSIGNED_SHORT, true, sizeof(PackedPosition), offsetof(PackedPosition, pos)});
+		}
+	}
+
+	void release() noexcept
+	{
+		if (arena) {
+			if (inArena) {
+				arena->release(range);
+			}
+			arena->removeDraws(drawIndex, modelMatrices.size());
+		}
+		glDeleteBuffers(1, &ebo);
+		glDeleteBuffers(1, &vbo);
+		glDeleteBuffers(1, &positionVbo);
+		glDeleteVertexArrays(1, &vao);
+		glDeleteVertexArrays(1, &depthVao);
 	}
 };
@@ -0,0 +1,510 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <glad.h>
+#include "model.hh"
+#include "parallel.hh"
+#include "util.hh"
+#include "obj_parser/parser.hh"
+#include "obj_parser/mesh_cache.hh"
+#include "obj_parser/packed_model.hh"
+#include "obj_parser/mesh_optimizer.hh"
+#include "obj_parser/material_groups.hh"
+#include "gltf/glb_reader.hh"
+
+// Loads a model on a worker thread while the render thread keeps drawing. The
+// worker reads the mesh cache or parses the file (or reads the .glb file), and
+// queues the material table followed by the finished meshes. Every call to
+// update() uploads at most uploadBudget bytes, so a frame never has to wait
+// for more than a bounded amount of upload work. Meshes that exceed the budget
+// are spread over several frames and only become visible once they are
+// complete.
+//
+// Several files are combined into one model. Those without a valid cache are
+// parsed concurrently, and their meshes are queued in the order of the files
+// once all of them are done. The materials of every file are appended to the
+// material table in the same order.
+//
+// Parsed meshes are optimized for the vertex cache and for overdraw before they
+// are queued and cached, see optimizeMesh.
+//
+// The triangles of OBJ files can be regrouped into one mesh per material, see
+// groupByMaterial, which takes one draw call per material of a file instead of
+// one per object. The material of these meshes is set for the whole mesh.
+//
+// Alternatively, objects that are copies of each other, see findInstances, can
+// become a single mesh with an instance for every copy. Its geometry is only
+// uploaded once, and all instances are drawn with one call. Copies are found
+// when a file is parsed and kept in its cache, so this costs nothing on a
+// cache hit.
+class MeshLoader {
+public:
+	enum Grouping {
+		// One mesh per object of the file.
+		BY_OBJECT,
+		BY_MATERIAL,
+		// One mesh per distinct geometry of the file.
+		BY_GEOMETRY
+	};
+
+	// Where the meshes and materials of a file ended up in the model.
+	struct LoadedFile {
+		std::filesystem::path path;
+		size_t meshCount {0};
+		// Index in the material table of every material of the file.
+		std::vector<uint32_t> materialIds;
+		// Of the OBJ file that the meshes were read from, see
+		// PackedModel::source.
+		std::optional<FileStamp> stamp;
+	};
+
+private:
+	// Vertex and index arrays of a mesh in the form in which they are uploaded.
+	// They point into storage, which is a mapping of the cache or of a .glb
+	// file, or the arrays of a model that has just been packed.
+	struct PendingMesh {
+		std::shared_ptr<void const> storage;
+		std::string_view vertices;
+		size_t vertexCount {0};
+		VertexLayout layout;
+		// Empty unless the layout is packed.
+		std::string_view positions;
+		std::string_view indices;
+		size_t indexCount {0};
+		GLenum indexType {GL_UNSIGNED_INT};
+		Bounds bounds;
+		// One for every instance.
+		std::vector<glm::mat4> modelMatrices {glm::mat4(1.0f)};
+	};
+
+	// Shared with the worker thread.
+	std::mutex mutex;
+	std::deque<PendingMesh> queue;
+	std::optional<std::vector<Material>> materials;
+	std::optional<std::string> error;
+	bool finished {false};
+	std::atomic<bool> cancelled {false};
+	// Only written by the worker thread before it finishes.
+	std::vector<LoadedFile> loadedFiles;
+	std::vector<Material> loadedMaterials;
+	QuantizationError quantizationError;
+
+	Grouping grouping;
+
+	// Only used by the render thread.
+	size_t uploadBudget;
+	std::optional<PendingMesh> current;
+	std::optional<Mesh> currentMesh;
+	size_t uploadedBytes {0};
+
+	// Declared last, so that the thread starts after everything else has been
+	// initialized.
+	std::thread worker;
+public:
+	explicit MeshLoader(
+		std::vector<std::filesystem::path> paths,
+		Grouping grouping = BY_OBJECT,
+		size_t uploadBudget = 4 << 20)
+		: grouping(grouping), uploadBudget(uploadBudget), worker([this, paths = std::move(paths)] { load(paths); })
+	{
+	}
+
+	explicit MeshLoader(std::filesystem::path path, Grouping grouping = BY_OBJECT, size_t uploadBudget = 4 << 20)
+		: MeshLoader(std::vector {std::move(path)}, grouping, uploadBudget)
+	{
+	}
+
+	MeshLoader(MeshLoader const &) = delete;
+
+	MeshLoader &operator=(MeshLoader const &) = delete;
+
+	// Waits for the worker thread. A running parse cannot be interrupted, but
+	// nothing else is queued after it.
+	~MeshLoader()
+	{
+		cancelled = true;
+		worker.join();
+	}
+
+	// Uploads the material table and queued meshes until the budget is used
+	// up, and appends the meshes that are complete to the model. Errors of the
+	// worker thread are rethrown here. Returns false once all meshes have been
+	// uploaded.
+	bool update(Model &model)
+	{
+		size_t budget = uploadBudget;
+		while (budget > 0) {
+			if (!current) {
+				std::lock_guard lock(mutex);
+				if (error) {
+					util::fatalError(*error);
+				}
+				if (materials) {
+					model.materials.upload(*materials);
+					materials.reset();
+				}
+				if (queue.empty()) {
+					return !finished;
+				}
+				current = std::move(queue.front());
+				queue.pop_front();
+			}
+			if (!currentMesh) {
+				// Making room in the arena copies everything in it. Unless that
+				// fits into the rest of the budget, it waits for the next frame,
+				// so a frame does at most a budget or a copy worth of work.
+				size_t growthCost = 0;
+				if (Mesh::isStoredInArena(current->layout, current->indexCount)) {
+					growthCost = model.geometry->getGrowthCost(current->vertexCount, current->indexCount,
+					                                           current->indexType);
+				}
+				if (growthCost > budget && budget < uploadBudget) {
+					return true;
+				}
+				budget -= std::min(budget, growthCost);
+				currentMesh.emplace(model.geometry, nullptr, current->vertices.size(), current->vertexCount,
+				                    current->layout, nullptr, nullptr, current->indexCount, current->indexType,
+				                    current->bounds, current->modelMatrices.size());
+				for (size_t i = 0; i < current->modelMatrices.size(); ++i) {
+					currentMesh->setModelMatrix(current->modelMatrices[i], i);
+				}
+			}
+
+			// The vertex bytes are uploaded first, followed by the positions,
+			// the draw indices and the index bytes.
+			size_t vertexBytes = current->vertices.size();
+			size_t positionBytes = current->positions.size();
+			size_t drawIndexBytes = currentMesh->isInArena() ? current->vertexCount * sizeof(uint32_t) : 0;
+			size_t indexBegin = vertexBytes + positionBytes + drawIndexBytes;
+			size_t totalBytes = indexBegin + current->indices.size();
+			size_t end = std::min(totalBytes, uploadedBytes + budget);
+			uploadSection(uploadedBytes, end, 0, vertexBytes, [&](size_t offset, size_t size) {
+				currentMesh->updateVertices(offset, current->vertices.data() + offset, size);
+			});
+			uploadSection(uploadedBytes, end, vertexBytes, positionBytes, [&](size_t offset, size_t size) {
+				currentMesh->updatePositions(offset, current->positions.data() + offset, size);
+			});
+			uploadSection(uploadedBytes, end, vertexBytes + positionBytes, drawIndexBytes,
+			              [&](size_t offset, size_t size) {
+				currentMesh->updateDrawIndices(offset, size);
+			});
+			uploadSection(uploadedBytes, end, indexBegin, current->indices.size(), [&](size_t offset, size_t size) {
+				currentMesh->updateIndices(offset, current->indices.data() + offset, size);
+			});
+			budget -= end - uploadedBytes;
+			uploadedBytes = end;
+
+			if (uploadedBytes == totalBytes) {
+				model.addMesh(std::move(*currentMesh));
+				currentMesh.reset();
+				current.reset();
+				uploadedBytes = 0;
+			}
+		}
+		return true;
+	}
+
+	// The files in the order of their meshes in the model. Only valid after
+	// update() has returned false.
+	[[nodiscard]] std::vector<LoadedFile> const &getFiles() const noexcept
+	{
+		return loadedFiles;
+	}
+
+	// The whole material table. Only valid after update() has returned false.
+	[[nodiscard]] std::vector<Material> const &getMaterials() const noexcept
+	{
+		return loadedMaterials;
+	}
+
+	// The largest error of the packed vertices of all meshes that were
+	// packed, see PackedVertex. Only valid after update() has returned false.
+	[[nodiscard]] QuantizationError const &getQuantizationError() const noexcept
+	{
+		return quantizationError;
+	}
+
+private:
+	void load(std::vector<std::filesystem::path> const &paths)
+	{
+		try {
+			if (paths.size() != 1) {
+				loadFiles(paths);
+			} else if (isGlbFile(paths[0])) {
+				loadGlb(paths[0]);
+			} else {
+				loadObj(paths[0]);
+			}
+		} catch (std::string &message) {
+			std::lock_guard lock(mutex);
+			error = message;
+		} catch (std::exception &exception) {
+			std::lock_guard lock(mutex);
+			error = exception.what();
+		}
+
+		std::lock_guard lock(mutex);
+		finished = true;
+	}
+
+	// Meshes and material table of a file.
+	struct FileContent {
+		std::vector<PendingMesh> meshes;
+		std::vector<Material> materials;
+		std::optional<FileStamp> stamp;
+	};
+
+	// Reads the mesh cache, or parses the file and writes the cache.
+	void loadObj(std::filesystem::path const &path)
+	{
+		std::filesystem::path cachePath = getMeshCachePath(path);
+		std::optional<PackedModel> model = readMeshCache(cachePath, path);
+		bool cached = model.has_value();
+		if (!cached) {
+			// Leave one hardware thread to the render loop.
+			unsigned threadCount = std::max(1u, util::hardwareThreadCount() - 1);
+			std::optional<FileStamp> stamp = getFileStamp(path);
+			model = pack(parseObjFile(path, threadCount), threadCount, stamp);
+		}
+
+		FileContent file = prepare(*model);
+		publish(file.materials);
+		size_t meshCount = file.meshes.size();
+		for (PendingMesh &mesh: file.meshes) {
+			push(std::move(mesh));
+		}
+		if (!cached) {
+			writeMeshCache(cachePath, path, *model);
+		}
+		addFile(path, meshCount, std::move(file.materials), file.stamp);
+	}
+
+	void loadGlb(std::filesystem::path const &path)
+	{
+		FileContent file = prepare(std::make_shared<GlbModel>(readGlbFile(path)));
+		publish(file.materials);
+		size_t meshCount = file.meshes.size();
+		for (PendingMesh &mesh: file.meshes) {
+			push(std::move(mesh));
+		}
+		addFile(path, meshCount, std::move(file.materials), file.stamp);
+	}
+
+	void loadFiles(std::vector<std::filesystem::path> const &paths)
+	{
+		std::vector<FileContent> files(paths.size());
+		std::vector<std::filesystem::path> parsePaths;
+		std::vector<size_t> parseIndices;
+		for (size_t i = 0; i < paths.size() && !cancelled; ++i) {
+			if (isGlbFile(paths[i])) {
+				files[i] = prepare(std::make_shared<GlbModel>(readGlbFile(paths[i])));
+			} else if (auto model = readMeshCache(getMeshCachePath(paths[i]), paths[i])) {
+				files[i] = prepare(*model);
+			} else {
+				parsePaths.push_back(paths[i]);
+				parseIndices.push_back(i);
+			}
+		}
+
+		if (!parsePaths.empty() && !cancelled) {
+			// Leave one hardware thread to the render loop.
+			unsigned threadCount = std::max(1u, util::hardwareThreadCount() - 1);
+			std::vector<std::optional<FileStamp>> stamps;
+			for (auto const &path: parsePaths) {
+				stamps.push_back(getFileStamp(path));
+			}
+			std::vector<ModelData> models = parseObjFiles(parsePaths, threadCount);
+			for (size_t k = 0; k < models.size(); ++k) {
+				PackedModel model = pack(std::move(models[k]), threadCount, stamps[k]);
+				writeMeshCache(getMeshCachePath(parsePaths[k]), parsePaths[k], model);
+				files[parseIndices[k]] = prepare(model);
+			}
+		}
+
+		for (size_t i = 0; i < files.size(); ++i) {
+			addFile(paths[i], files[i].meshes.size(), std::move(files[i].materials), files[i].stamp);
+			for (PendingMesh &mesh: files[i].meshes) {
+				remapMaterials(mesh, loadedFiles.back().materialIds);
+			}
+		}
+		publish(loadedMaterials);
+		for (FileContent &file: files) {
+			for (PendingMesh &mesh: file.meshes) {
+				push(std::move(mesh));
+			}
+		}
+	}
+
+	// Optimizes the meshes of a parsed file before they are packed, see
+	// optimizeMeshes. The stamp has to be taken before parsing.
+	static PackedModel pack(ModelData &&model, unsigned threadCount, std::optional<FileStamp> const &stamp)
+	{
+		std::vector<MeshInstances> instances = optimizeMeshes(model.meshes, threadCount);
+		PackedModel packed = packModel(model, instances, threadCount);
+		packed.source = stamp;
+		return packed;
+	}
+
+	// Appends the materials of the file to the table. Each file keeps its own
+	// entries, even if another file has the same colors, so that they can be
+	// changed later without affecting the other file.
+	void addFile(
+		std::filesystem::path const &path,
+		size_t meshCount,
+		std::vector<Material> &&materials,
+		std::optional<FileStamp> const &stamp)
+	{
+		LoadedFile file {path, meshCount, {}, stamp};
+		for (Material const &material: materials) {
+			file.materialIds.push_back(static_cast<uint32_t>(loadedMaterials.size()));
+			loadedMaterials.push_back(material);
+		}
+		loadedFiles.push_back(std::move(file));
+	}
+
+	static void remapMaterials(PendingMesh &mesh, std::vector<uint32_t> const &ids)
+	{
+		VertexLayout &layout = mesh.layout;
+		if (!layout.perVertexMaterial) {
+			layout.constantMaterial = ids[layout.constantMaterial];
+		} else if (!ids.empty()) {
+			// The materials of a file are consecutive in the table, see
+			// addFile, so the vertices keep their own indices.
+			layout.materialOffset = ids[0];
+		}
+	}
+
+	void publish(std::vector<Material> table)
+	{
+		std::lock_guard lock(mutex);
+		materials = std::move(table);
+	}
+
+	void push(PendingMesh &&mesh)
+	{
+		if (!cancelled) {
+			std::lock_guard lock(mutex);
+			queue.push_back(std::move(mesh));
+		}
+	}
+
+	// Groups the objects of a cached or parsed OBJ file into meshes, which
+	// share the storage of the model. Grouping by material has to unpack the
+	// vertices of every object first, see unpackObject.
+	FileContent prepare(PackedModel const &model)
+	{
+		quantizationError.merge(model.quantizationError);
+		FileContent file;
+		file.materials = model.materials;
+		file.stamp = model.source;
+		if (grouping == BY_MATERIAL) {
+			std::vector<MeshData> meshes;
+			for (size_t i = 0; i < model.objects.size(); ++i) {
+				meshes.push_back(unpackObject(model, i));
+			}
+			for (MeshData const &group: groupByMaterial(meshes)) {
+				file.meshes.push_back(prepareGroup(group));
+			}
+		} else if (grouping == BY_GEOMETRY) {
+			std::vector<std::vector<glm::mat4>> instances(model.geometries.size());
+			for (PackedObject const &object: model.objects) {
+				instances[object.geometry].push_back(object.transform);
+			}
+			for (size_t i = 0; i < model.geometries.size(); ++i) {
+				if (!instances[i].empty()) {
+					file.meshes.push_back(prepare(model, i, std::move(instances[i])));
+				}
+			}
+		} else {
+			for (PackedObject const &object: model.objects) {
+				file.meshes.push_back(prepare(model, object.geometry, {object.transform}));
+			}
+		}
+		return file;
+	}
+
+	// A mesh with an instance for every model matrix.
+	static PendingMesh prepare(PackedModel const &model, size_t geometry, std::vector<glm::mat4> modelMatrices)
+	{
+		PackedGeometry const &packed = model.geometries[geometry];
+		PendingMesh pending;
+		pending.storage = model.storage;
+		pending.vertices = packed.vertices;
+		pending.vertexCount = packed.vertexCount;
+		pending.layout = VertexLayout::packed(packed.quantization);
+		pending.positions = packed.positions;
+		pending.indices = packed.indices;
+		pending.indexCount = packed.indexCount;
+		pending.indexType = packed.indexType;
+		pending.bounds = packed.bounds;
+		pending.modelMatrices = std::move(modelMatrices);
+		return pending;
+	}
+
+	// The buffer views point into the mapped file, unless the primitive had
+	// to be converted.
+	FileContent prepare(std::shared_ptr<GlbModel> const &model)
+	{
+		FileContent file;
+		for (GlbPrimitive const &primitive: model->primitives) {
+			PendingMesh pending;
+			if (primitive.converted) {
+				pending = prepare(*primitive.converted);
+			} else {
+				pending.storage = model;
+				pending.vertices = primitive.vertices;
+				pending.vertexCount = primitive.vertexCount;
+				pending.layout = primitive.layout;
+				pending.indices = primitive.indices;
+				pending.indexCount = primitive.indexCount;
+				pending.indexType = primitive.indexType;
+				pending.bounds = primitive.bounds;
+			}
+			pending.modelMatrices = {primitive.transform};
+			file.meshes.push_back(std::move(pending));
+		}
+		file.materials = model->materials;
+		return file;
+	}
+
+	// All vertices of a group have the same material.
+	PendingMesh prepareGroup(MeshData const &group)
+	{
+		PendingMesh pending = prepare(group);
+		pending.layout.perVertexMaterial = false;
+		pending.layout.constantMaterial = group.vertices[0].material;
+		return pending;
+	}
+
+	// Same layout as Mesh(MeshData const &) uses.
+	PendingMesh prepare(MeshData const &data)
+	{
+		PackedModel packed = packMesh(data);
+		quantizationError.merge(packed.quantizationError);
+		return prepare(packed, 0, {glm::mat4(1.0f)});
+	}
+
+	// Uploads the bytes of a section that lie in [begin, end). The section
+	// starts at sectionBegin of all the bytes of the mesh. Update gets the
+	// offset and the size relative to the section.
+	template<typename Update>
+	static void uploadSection(size_t begin, size_t end, size_t sectionBegin, size_t sectionSize, Update const &update)
+	{
+		size_t first = std::max(begin, sectionBegin);
+		size_t last = std::min(end, sectionBegin + sectionSize);
+		if (first < last) {
+			update(first - sectionBegin, last - first);
+		}
+	}
+};
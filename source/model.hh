@@ -0,0 +1,100 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <cstddef>
+#include <utility>
+#include <iterator>
+#include <glad.h>
+#include "mesh.hh"
+#include "geometry_arena.hh"
+#include "material_table.hh"
+
+// All meshes of a model file, together with the materials they refer to.
+struct Model {
+	// Holds the geometry and the draw data of the meshes, which must be
+	// created with it.
+	std::shared_ptr<GeometryArena> geometry {std::make_shared<GeometryArena>()};
+	std::vector<Mesh> meshes;
+	MaterialTable materials;
+	// Bounds of all meshes together, in world space.
+	Bounds bounds;
+
+	void addMesh(Mesh &&mesh)
+	{
+		bounds = mergeBounds(bounds, mesh.getWorldBounds());
+		meshes.push_back(std::move(mesh));
+	}
+
+	// Replaces count meshes beginning at begin with the new ones, which may be
+	// more or fewer.
+	void replaceMeshes(size_t begin, size_t count, std::vector<Mesh> &&replacement)
+	{
+		auto first = meshes.begin() + static_cast<ptrdiff_t>(begin);
+		first = meshes.erase(first, first + static_cast<ptrdiff_t>(count));
+		meshes.insert(first, std::make_move_iterator(replacement.begin()), std::make_move_iterator(replacement.end()));
+		bounds = {};
+		for (Mesh const &mesh: meshes) {
+			bounds = mergeBounds(bounds, mesh.getWorldBounds());
+		}
+	}
+
+	// Draws the meshes in the arena that have a single instance with one call
+	// per index type, and the others one by one. The draw data must have been
+	// uploaded.
+	void draw() const
+	{
+		glBindVertexArray(geometry->getVao());
+		drawArenaMeshes();
+		for (Mesh const &mesh: meshes) {
+			if (!isMultiDrawn(mesh)) {
+				mesh.draw();
+			}
+		}
+	}
+
+	// Same as draw(), but only with the positions, see Mesh::drawDepth.
+	void drawDepth() const
+	{
+		glBindVertexArray(geometry->getDepthVao());
+		drawArenaMeshes();
+		for (Mesh const &mesh: meshes) {
+			if (!isMultiDrawn(mesh)) {
+				mesh.drawDepth();
+			}
+		}
+	}
+
+private:
+	// OpenGL 3.3 cannot draw several meshes with several instances each in
+	// one call.
+	static bool isMultiDrawn(Mesh const &mesh) noexcept
+	{
+		return mesh.isInArena() && mesh.getInstanceCount() == 1;
+	}
+
+	// Expects a VAO of the arena to be bound.
+	void drawArenaMeshes() const
+	{
+		std::vector<GLsizei> counts;
+		std::vector<void const *> offsets;
+		std::vector<GLint> baseVertices;
+		for (GLenum type: {GL_UNSIGNED_SHORT, GL_UNSIGNED_INT}) {
+			counts.clear();
+			offsets.clear();
+			baseVertices.clear();
+			for (Mesh const &mesh: meshes) {
+				GeometryArena::Range const &range = mesh.getRange();
+				if (isMultiDrawn(mesh) && range.indexType == type) {
+					counts.push_back(static_cast<GLsizei>(range.indexCount));
+					offsets.push_back((void const *) range.indexOffset);
+					baseVertices.push_back(static_cast<GLint>(range.baseVertex));
+				}
+			}
+			if (!counts.empty()) {
+				glMultiDrawElementsBaseVertex(GL_TRIANGLES, counts.data(), type, offsets.data(),
+				                              static_cast<GLsizei>(counts.size()), baseVertices.data());
+			}
+		}
+	}
+};
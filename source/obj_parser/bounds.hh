@@ -0,0 +1,123 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <algorithm>
+#include <glm/glm.hpp>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#include "obj_parser/vertex.hh"
+
+// Axis-aligned bounding box and bounding sphere of a mesh or a whole scene.
+// Both are empty until the first point is added. The sphere is centered on the
+// box, which makes it slightly larger than the minimal one, but it only takes
+// one more pass over the positions.
+struct Bounds {
+	glm::vec3 min {std::numeric_limits<float>::infinity()};
+	glm::vec3 max {-std::numeric_limits<float>::infinity()};
+	glm::vec3 center {0.0f};
+	float radius {-1.0f};
+
+	[[nodiscard]] bool isEmpty() const noexcept
+	{
+		return radius < 0.0f;
+	}
+};
+
+// Computes the bounds of the vertex positions.
+inline Bounds computeBounds(Vertex const *vertices, size_t count) noexcept
+{
+	Bounds result;
+	if (count == 0) {
+		return result;
+	}
+
+#if defined(__SSE2__)
+	// Each load also picks up the x component of the normal, whose lane is
+	// simply ignored.
+	static_assert(offsetof(Vertex, pos) + 4 * sizeof(float) <= sizeof(Vertex));
+	__m128 low = _mm_set1_ps(std::numeric_limits<float>::infinity());
+	__m128 high = _mm_set1_ps(-std::numeric_limits<float>::infinity());
+	for (size_t i = 0; i < count; ++i) {
+		__m128 position = _mm_loadu_ps(&vertices[i].pos.x);
+		low = _mm_min_ps(low, position);
+		high = _mm_max_ps(high, position);
+	}
+	float lanes[4];
+	_mm_storeu_ps(lanes, low);
+	result.min = {lanes[0], lanes[1], lanes[2]};
+	_mm_storeu_ps(lanes, high);
+	result.max = {lanes[0], lanes[1], lanes[2]};
+#else
+	for (size_t i = 0; i < count; ++i) {
+		result.min = glm::min(result.min, vertices[i].pos);
+		result.max = glm::max(result.max, vertices[i].pos);
+	}
+#endif
+
+	result.center = (result.min + result.max) * 0.5f;
+	float squaredRadius = 0.0f;
+	for (size_t i = 0; i < count; ++i) {
+		glm::vec3 offset = vertices[i].pos - result.center;
+		squaredRadius = std::max(squaredRadius, glm::dot(offset, offset));
+	}
+	result.radius = std::sqrt(squaredRadius);
+	return result;
+}
+
+// Returns bounds that contain both a and b.
+inline Bounds mergeBounds(Bounds const &a, Bounds const &b) noexcept
+{
+	if (a.isEmpty()) {
+		return b;
+	}
+	if (b.isEmpty()) {
+		return a;
+	}
+
+	Bounds result;
+	result.min = glm::min(a.min, b.min);
+	result.max = glm::max(a.max, b.max);
+
+	float distance = glm::length(b.center - a.center);
+	if (distance + b.radius <= a.radius) {
+		result.center = a.center;
+		result.radius = a.radius;
+	} else if (distance + a.radius <= b.radius) {
+		result.center = b.center;
+		result.radius = b.radius;
+	} else {
+		result.radius = (distance + a.radius + b.radius) * 0.5f;
+		result.center = a.center + (b.center - a.center) * ((result.radius - a.radius) / distance);
+	}
+	return result;
+}
+
+// Returns bounds that contain the given bounds after they have been
+// transformed by matrix, which must be affine.
+inline Bounds transformBounds(Bounds const &bounds, glm::mat4 const &matrix) noexcept
+{
+	if (bounds.isEmpty()) {
+		return bounds;
+	}
+
+	// The extents of the box along each axis of the transformed space.
+	Bounds result;
+	glm::vec3 center = (bounds.min + bounds.max) * 0.5f;
+	glm::vec3 extent = (bounds.max - bounds.min) * 0.5f;
+	glm::vec3 transformedCenter = glm::vec3(matrix * glm::vec4(center, 1.0f));
+	glm::vec3 transformedExtent(0.0f);
+	for (int i = 0; i < 3; ++i) {
+		transformedExtent += glm::abs(glm::vec3(matrix[i])) * extent[i];
+	}
+	result.min = transformedCenter - transformedExtent;
+	result.max = transformedCenter + transformedExtent;
+
+	float scale = std::max({glm::length(glm::vec3(matrix[0])), glm::length(glm::vec3(matrix[1])),
+	                        glm::length(glm::vec3(matrix[2]))});
+	result.center = glm::vec3(matrix * glm::vec4(bounds.center, 1.0f));
+	result.radius = bounds.radius * scale;
+	return result;
+}
@@ -0,0 +1,195 @@
+#include <cstdio>
+#include <exception>
+#include <memory>
+#include "compressed_file.hh"
+#include "util.hh"
+#ifdef VWA_HAS_ZLIB
+#include <zlib.h>
+#endif
+#ifdef VWA_HAS_ZSTD
+#include <zstd.h>
+#endif
+
+static bool hasExtension(std::filesystem::path const &path, char const *extension)
+{
+	return path.extension() == extension;
+}
+
+bool isCompressedFile(std::filesystem::path const &path)
+{
+	return hasExtension(path, ".gz") || hasExtension(path, ".zst");
+}
+
+DecompressionStream::DecompressionStream(std::filesystem::path path, size_t blockSize, size_t blockCount)
+	: path(std::move(path)), blockSize(blockSize), ring(blockCount), worker([this] { decompress(); })
+{
+}
+
+DecompressionStream::~DecompressionStream()
+{
+	{
+		std::lock_guard lock(mutex);
+		cancelled = true;
+	}
+	changed.notify_all();
+	worker.join();
+}
+
+std::string_view DecompressionStream::next()
+{
+	std::unique_lock lock(mutex);
+	if (reading) {
+		++head;
+		reading = false;
+		changed.notify_all();
+	}
+	changed.wait(lock, [this] { return head < tail || finished || error; });
+	if (error) {
+		util::fatalError(*error);
+	}
+	if (head == tail) {
+		return {};
+	}
+	reading = true;
+	Block const &block = ring[head % ring.size()];
+	return {block.data.data(), block.size};
+}
+
+DecompressionStream::Block *DecompressionStream::acquire()
+{
+	std::unique_lock lock(mutex);
+	changed.wait(lock, [this] { return tail - head < ring.size() || cancelled; });
+	if (cancelled) {
+		return nullptr;
+	}
+	Block &block = ring[tail % ring.size()];
+	// Blocks are only allocated once they are needed, small files use one.
+	block.data.resize(blockSize);
+	block.size = 0;
+	return &block;
+}
+
+void DecompressionStream::release()
+{
+	{
+		std::lock_guard lock(mutex);
+		++tail;
+	}
+	changed.notify_all();
+}
+
+void DecompressionStream::decompress()
+{
+	try {
+		if (hasExtension(path, ".gz")) {
+			decompressGzip();
+		} else {
+			decompressZstd();
+		}
+	} catch (std::string &message) {
+		std::lock_guard lock(mutex);
+		error = message;
+	} catch (std::exception &exception) {
+		std::lock_guard lock(mutex);
+		error = exception.what();
+	}
+
+	{
+		std::lock_guard lock(mutex);
+		finished = true;
+	}
+	changed.notify_all();
+}
+
+void DecompressionStream::decompressGzip()
+{
+#ifdef VWA_HAS_ZLIB
+	std::unique_ptr<gzFile_s, int (*)(gzFile)> file(gzopen(path.c_str(), "rb"), gzclose);
+	if (!file) {
+		util::fatalError("Could not open file: ", path);
+	}
+	// The default of 8 KiB makes zlib read the file in tiny pieces.
+	gzbuffer(file.get(), 1 << 17);
+
+	while (Block *block = acquire()) {
+		int size = gzread(file.get(), block->data.data(), static_cast<unsigned>(block->data.size()));
+		if (size < 0) {
+			util::fatalError("Could not decompress file: ", path);
+		}
+		if (size == 0) {
+			break;
+		}
+		block->size = static_cast<size_t>(size);
+		release();
+	}
+	// gzread() returns the data before a truncated end without an error.
+	int status = Z_OK;
+	gzerror(file.get(), &status);
+	if (status != Z_OK) {
+		util::fatalError("Could not decompress file: ", path);
+	}
+#else
+	util::fatalError("Gzip files are not supported in this build: ", path);
+#endif
+}
+
+void DecompressionStream::decompressZstd()
+{
+#ifdef VWA_HAS_ZSTD
+	std::unique_ptr<FILE, int (*)(FILE *)> file(std::fopen(path.c_str(), "rb"), std::fclose);
+	if (!file) {
+		util::fatalError("Could not open file: ", path);
+	}
+	std::unique_ptr<ZSTD_DCtx, size_t (*)(ZSTD_DCtx *)> context(ZSTD_createDCtx(), ZSTD_freeDCtx);
+	std::vector<char> input(ZSTD_DStreamInSize());
+	ZSTD_inBuffer in {input.data(), 0, 0};
+	// Zero once a frame has been decoded and flushed completely.
+	size_t result = 0;
+	bool outputFull = false;
+
+	Block *block = acquire();
+	while (block) {
+		// The decoder may still hold output if it filled the last block, even
+		// when all input has been consumed.
+		if (in.pos == in.size && !outputFull) {
+			in.size = std::fread(input.data(), 1, input.size(), file.get());
+			in.pos = 0;
+			if (in.size == 0) {
+				break;
+			}
+		}
+		ZSTD_outBuffer out {block->data.data() + block->size, block->data.size() - block->size, 0};
+		result = ZSTD_decompressStream(context.get(), &out, &in);
+		if (ZSTD_isError(result)) {
+			util::fatalError("Could not decompress file: ", path, ": ", ZSTD_getErrorName(result));
+		}
+		block->size += out.pos;
+		outputFull = out.pos == out.size;
+		if (block->size == block->data.size()) {
+			release();
+			block = acquire();
+		}
+	}
+	if (std::ferror(file.get())) {
+		util::fatalError("Could not read file: ", path);
+	}
+	if (block && result != 0) {
+		util::fatalError("Compressed file is truncated: ", path);
+	}
+	if (block && block->size > 0) {
+		release();
+	}
+#else
+	util::fatalError("Zstandard files are not supported in this build: ", path);
+#endif
+}
+
+std::string readDecompressedFile(std::filesystem::path const &path)
+{
+	DecompressionStream stream(path);
+	std::string result;
+	for (std::string_view block = stream.next(); !block.empty(); block = stream.next()) {
+		result += block;
+	}
+	return result;
+}
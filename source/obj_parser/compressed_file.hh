@@ -0,0 +1,73 @@
+#pragma once
+
+#include <condition_variable>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Returns true if the file name ends in .gz or .zst.
+[[nodiscard]] bool isCompressedFile(std::filesystem::path const &path);
+
+// Decompresses a gzip or zstd file on a separate thread, so that the caller can
+// parse one block while the next one is being decompressed. The blocks are kept
+// in a small ring of reusable buffers, which bounds the memory use no matter how
+// large the file is. Which formats are available depends on the libraries that
+// were found at build time.
+class DecompressionStream {
+	struct Block {
+		std::vector<char> data;
+		size_t size {0};
+	};
+
+	std::filesystem::path path;
+	size_t blockSize;
+	std::vector<Block> ring;
+
+	// Shared with the decompression thread. Blocks in [head, tail) are filled
+	// and waiting to be read, all others belong to the decompression thread.
+	std::mutex mutex;
+	std::condition_variable changed;
+	size_t head {0};
+	size_t tail {0};
+	bool finished {false};
+	bool cancelled {false};
+	// Whether the block at head has been returned by next() and is still in use.
+	bool reading {false};
+	std::optional<std::string> error;
+
+	// Declared last, so that the thread starts after everything else has been
+	// initialized.
+	std::thread worker;
+public:
+	explicit DecompressionStream(std::filesystem::path path, size_t blockSize = 1 << 20, size_t blockCount = 4);
+
+	DecompressionStream(DecompressionStream const &) = delete;
+
+	DecompressionStream &operator=(DecompressionStream const &) = delete;
+
+	~DecompressionStream();
+
+	// Returns the next block of decompressed bytes, or an empty view at the end
+	// of the file. The view stays valid until the next call. Errors of the
+	// decompression thread are rethrown here.
+	std::string_view next();
+
+private:
+	void decompress();
+
+	void decompressGzip();
+
+	void decompressZstd();
+
+	// Waits for an empty block, or returns nullptr if the stream was destroyed.
+	Block *acquire();
+
+	void release();
+};
+
+// Decompresses a whole gzip or zstd file into memory.
+[[nodiscard]] std::string readDecompressedFile(std::filesystem::path const &path);
@@ -0,0 +1,36 @@
+#include "file_stamp.hh"
+#include "mapped_file.hh"
+#include "util.hh"
+
+std::optional<FileStamp> getFileStamp(std::filesystem::path const &path, bool withHash)
+{
+	std::error_code error;
+	auto size = std::filesystem::file_size(path, error);
+	if (error) {
+		return {};
+	}
+	auto time = std::filesystem::last_write_time(path, error);
+	if (error) {
+		return {};
+	}
+
+	FileStamp stamp;
+	stamp.size = size;
+	stamp.modificationTime = static_cast<int64_t>(time.time_since_epoch().count());
+	if (withHash) {
+		stamp.contentHash = util::hashBytes(MappedFile(path).view());
+	}
+	return stamp;
+}
+
+bool isUpToDate(FileStamp const &stamp, std::filesystem::path const &path)
+{
+	std::optional<FileStamp> current = getFileStamp(path, false);
+	if (!current || current->size != stamp.size) {
+		return false;
+	}
+	if (current->modificationTime == stamp.modificationTime) {
+		return true;
+	}
+	return util::hashBytes(MappedFile(path).view()) == stamp.contentHash;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <filesystem>
+
+// The size, modification time and content hash of a file, which tell whether
+// it has changed since.
+struct FileStamp {
+	uint64_t size {0};
+	int64_t modificationTime {0};
+	uint64_t contentHash {0};
+};
+
+// Returns nothing if the file cannot be read. The content hash stays zero
+// unless withHash is true.
+std::optional<FileStamp> getFileStamp(std::filesystem::path const &path, bool withHash = true);
+
+// Whether the file has the same contents as when the stamp was taken. Only
+// hashes the file if its modification time has changed, for example after a
+// fresh checkout. Otherwise, checking a cache would cost as much as reading
+// the whole model.
+bool isUpToDate(FileStamp const &stamp, std::filesystem::path const &path);
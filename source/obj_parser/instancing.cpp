@@ -0,0 +1,196 @@
+#include <cmath>
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+#include <glm/glm.hpp>
+#include "instancing.hh"
+
+// Center, size and orientation of a mesh. The orientation is derived from two
+// vertices, and the same vertices of a copy give the orientation of the copy.
+struct Frame {
+	glm::vec3 center {0.0f};
+	// Root mean square distance of the vertices from the center.
+	float size {0.0f};
+	glm::mat3 axes {1.0f};
+};
+
+// The first mesh with a certain geometry, which later meshes are compared to.
+struct Reference {
+	uint32_t first {0};
+	uint32_t second {0};
+	Frame frame;
+};
+
+// Copies have the same triangles and materials, only the positions and normals
+// differ.
+static uint64_t hashTopology(MeshData const &mesh)
+{
+	uint64_t hash = 14695981039346656037ull;
+	auto add = [&](uint64_t value) {
+		hash = (hash ^ value) * 1099511628211ull;
+	};
+	add(mesh.vertices.size());
+	for (uint32_t index: mesh.indices) {
+		add(index);
+	}
+	for (Vertex const &vertex: mesh.vertices) {
+		add(vertex.material);
+	}
+	return hash;
+}
+
+static bool haveSameTopology(MeshData const &a, MeshData const &b)
+{
+	if (a.vertices.size() != b.vertices.size() || a.indices != b.indices) {
+		return false;
+	}
+	for (size_t i = 0; i < a.vertices.size(); ++i) {
+		if (a.vertices[i].material != b.vertices[i].material) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Unlike the center of the bounds, the centroid moves with the vertices when
+// they are rotated.
+static glm::vec3 computeCentroid(MeshData const &mesh)
+{
+	glm::dvec3 sum(0.0);
+	for (Vertex const &vertex: mesh.vertices) {
+		sum += glm::dvec3(vertex.pos);
+	}
+	return glm::vec3(sum / double(mesh.vertices.size()));
+}
+
+// Without a frame if the two vertices are in line with the center.
+static std::optional<Frame> computeFrame(MeshData const &mesh, uint32_t first, uint32_t second)
+{
+	Frame frame;
+	frame.center = computeCentroid(mesh);
+	double squares = 0.0;
+	for (Vertex const &vertex: mesh.vertices) {
+		glm::vec3 offset = vertex.pos - frame.center;
+		squares += glm::dot(offset, offset);
+	}
+	frame.size = static_cast<float>(std::sqrt(squares / double(mesh.vertices.size())));
+
+	glm::vec3 u = mesh.vertices[first].pos - frame.center;
+	glm::vec3 w = glm::cross(u, mesh.vertices[second].pos - frame.center);
+	// Nearly collinear vertices would give an inaccurate orientation.
+	float minimum = 1e-3f * frame.size * frame.size;
+	if (glm::length(u) <= 1e-3f * frame.size || glm::length(w) <= minimum) {
+		return std::nullopt;
+	}
+	u = glm::normalize(u);
+	w = glm::normalize(w);
+	frame.axes = glm::mat3(u, glm::cross(w, u), w);
+	return frame;
+}
+
+// Picks the vertex farthest from the center, and the one that is farthest from
+// the line through it and the center, which give the most accurate frame.
+static std::optional<Reference> findReference(MeshData const &mesh)
+{
+	if (mesh.vertices.empty()) {
+		return std::nullopt;
+	}
+	glm::vec3 center = computeCentroid(mesh);
+	Reference reference;
+	float distance = -1.0f;
+	for (size_t i = 0; i < mesh.vertices.size(); ++i) {
+		float length = glm::length(mesh.vertices[i].pos - center);
+		if (length > distance) {
+			distance = length;
+			reference.first = static_cast<uint32_t>(i);
+		}
+	}
+	glm::vec3 axis = mesh.vertices[reference.first].pos - center;
+	distance = -1.0f;
+	for (size_t i = 0; i < mesh.vertices.size(); ++i) {
+		float length = glm::length(glm::cross(axis, mesh.vertices[i].pos - center));
+		if (length > distance) {
+			distance = length;
+			reference.second = static_cast<uint32_t>(i);
+		}
+	}
+	std::optional<Frame> frame = computeFrame(mesh, reference.first, reference.second);
+	if (!frame) {
+		return std::nullopt;
+	}
+	reference.frame = *frame;
+	return reference;
+}
+
+// Returns the transform from the reference mesh to the other mesh, if it is a
+// copy.
+static std::optional<glm::mat4> findTransform(
+	MeshData const &mesh,
+	Reference const &reference,
+	MeshData const &other,
+	float tolerance)
+{
+	if (!haveSameTopology(mesh, other)) {
+		return std::nullopt;
+	}
+	std::optional<Frame> frame = computeFrame(other, reference.first, reference.second);
+	if (!frame) {
+		return std::nullopt;
+	}
+	glm::mat3 rotation = frame->axes * glm::transpose(reference.frame.axes);
+	float scale = frame->size / reference.frame.size;
+	glm::vec3 translation = frame->center - scale * (rotation * reference.frame.center);
+
+	float maxDistance = tolerance * frame->size;
+	for (size_t i = 0; i < mesh.vertices.size(); ++i) {
+		Vertex const &vertex = mesh.vertices[i];
+		Vertex const &copy = other.vertices[i];
+		glm::vec3 position = scale * (rotation * vertex.pos) + translation;
+		if (glm::length(position - copy.pos) > maxDistance) {
+			return std::nullopt;
+		}
+		// Normals are unit vectors, unless they are zero.
+		if (glm::length(rotation * vertex.normal - copy.normal) > tolerance * 10.0f) {
+			return std::nullopt;
+		}
+	}
+
+	glm::mat4 transform(1.0f);
+	for (int i = 0; i < 3; ++i) {
+		transform[i] = glm::vec4(scale * rotation[i], 0.0f);
+	}
+	transform[3] = glm::vec4(translation, 1.0f);
+	return transform;
+}
+
+std::vector<MeshInstances> findInstances(std::vector<MeshData> const &meshes, float tolerance)
+{
+	std::vector<MeshInstances> result;
+	// Empty for meshes that no other mesh can be a copy of, because all of
+	// their vertices are in a line.
+	std::vector<std::optional<Reference>> references;
+	// Indices into the result, by the hash of the topology.
+	std::unordered_multimap<uint64_t, size_t> candidates;
+	for (size_t i = 0; i < meshes.size(); ++i) {
+		uint64_t hash = hashTopology(meshes[i]);
+		bool found = false;
+		auto [begin, end] = candidates.equal_range(hash);
+		for (auto it = begin; it != end && !found; ++it) {
+			MeshInstances &instances = result[it->second];
+			std::optional<Reference> const &reference = references[it->second];
+			if (reference) {
+				if (auto transform = findTransform(meshes[instances.meshes[0]], *reference, meshes[i], tolerance)) {
+					instances.meshes.push_back(i);
+					instances.transforms.push_back(*transform);
+					found = true;
+				}
+			}
+		}
+		if (!found) {
+			candidates.emplace(hash, result.size());
+			result.push_back({{i}, {glm::mat4(1.0f)}});
+			references.push_back(findReference(meshes[i]));
+		}
+	}
+	return result;
+}
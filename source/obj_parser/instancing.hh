@@ -0,0 +1,26 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <glm/glm.hpp>
+#include "obj_parser/mesh_data.hh"
+
+// Meshes that are copies of each other.
+struct MeshInstances {
+	// Indices of the meshes. The geometry of the first one can be drawn for
+	// all of them.
+	std::vector<size_t> meshes;
+	// Map the first mesh to each of the meshes. The first transform is the
+	// identity.
+	std::vector<glm::mat4> transforms;
+};
+
+// Finds meshes that are copies of an earlier mesh up to a rotation, a uniform
+// scale and a translation, so that their geometry only has to be stored once.
+// Copies must have the same triangles and materials, and every position and
+// normal must match the transformed one within the tolerance, relative to the
+// size of the mesh. Mirrored copies are not found, as their triangles would
+// face the other way. Returns one entry per distinct geometry, in the order of
+// the meshes. Copies must also have their triangles in the same order, which
+// optimizeMeshes ensures.
+std::vector<MeshInstances> findInstances(std::vector<MeshData> const &meshes, float tolerance = 1e-4f);
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <string_view>
+#include <filesystem>
+#include <utility>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "util.hh"
+
+// Read-only memory mapping of a whole file. The contents are paged in lazily
+// by the kernel, so even very large files can be scanned without copying
+// them into user space first.
+class MappedFile {
+	char const *data {nullptr};
+	size_t size {0};
+public:
+	explicit MappedFile(std::filesystem::path const &path)
+	{
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0) {
+			util::fatalError("Could not open file: ", path);
+		}
+
+		struct stat info {};
+		if (fstat(fd, &info) != 0) {
+			close(fd);
+			util::fatalError("Could not stat file: ", path);
+		}
+
+		size = static_cast<size_t>(info.st_size);
+		// mmap does not accept zero-length mappings.
+		if (size > 0) {
+			void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (mapping == MAP_FAILED) {
+				close(fd);
+				util::fatalError("Could not map file: ", path);
+			}
+			madvise(mapping, size, MADV_SEQUENTIAL);
+			data = static_cast<char const *>(mapping);
+		}
+		close(fd);
+	}
+
+	MappedFile(MappedFile const &) = delete;
+
+	MappedFile &operator=(MappedFile const &) = delete;
+
+	MappedFile(MappedFile &&other) noexcept
+	{
+		*this = std::move(other);
+	}
+
+	MappedFile &operator=(MappedFile &&other) noexcept
+	{
+		if (this != &other) {
+			unmap();
+			data = std::exchange(other.data, nullptr);
+			size = std::exchange(other.size, 0);
+		}
+		return *this;
+	}
+
+	~MappedFile() noexcept
+	{
+		unmap();
+	}
+
+	[[nodiscard]] std::string_view view() const noexcept
+	{
+		return {data, size};
+	}
+
+private:
+	void unmap() noexcept
+	{
+		if (data) {
+			munmap(const_cast<char *>(data), size);
+		}
+	}
+};
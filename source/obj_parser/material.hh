@@ -0,0 +1,88 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <future>
+#include <memory>
+#include <string_view>
+#include <filesystem>
+#include <unordered_map>
+#include <memory_resource>
+#include <glm/vec3.hpp>
+#include "util.hh"
+
+struct Material {
+	glm::vec3 diffuse {0.8f, 0.8f, 0.8f};
+};
+
+// Materials of a library by name. The names and the nodes of the map are
+// allocated from an arena, which is released in one step with the library.
+class MaterialLibrary {
+	std::pmr::monotonic_buffer_resource arena;
+	std::pmr::unordered_map<std::string_view, Material> materials {&arena};
+public:
+	MaterialLibrary() = default;
+
+	MaterialLibrary(MaterialLibrary const &) = delete;
+
+	MaterialLibrary &operator=(MaterialLibrary const &) = delete;
+
+	// Adds a material with default values if there is none with the name.
+	Material &operator[](std::string_view name)
+	{
+		auto it = materials.find(name);
+		if (it == materials.end()) {
+			it = materials.emplace(util::intern(name, arena), Material {}).first;
+		}
+		return it->second;
+	}
+
+	// Returns nullptr if there is no material with the name.
+	[[nodiscard]] Material const *find(std::string_view name) const
+	{
+		auto it = materials.find(name);
+		return it != materials.end() ? &it->second : nullptr;
+	}
+};
+
+// Reads the newmtl and Kd statements of a Wavefront MTL file.
+std::unique_ptr<MaterialLibrary> parseMtlLibrary(std::filesystem::path const &);
+
+// Material libraries that are shared between files which are parsed at the
+// same time. Every library is parsed only once: the first thread that asks for
+// it parses it, and the others wait for the result. Errors are rethrown on
+// every thread that asks for the library.
+class MaterialLibraryCache {
+	using Entry = std::shared_future<std::shared_ptr<MaterialLibrary const>>;
+
+	std::mutex mutex;
+	std::map<std::filesystem::path, Entry> libraries;
+public:
+	[[nodiscard]] std::shared_ptr<MaterialLibrary const> get(std::filesystem::path const &path)
+	{
+		std::filesystem::path key = path.lexically_normal();
+		std::promise<std::shared_ptr<MaterialLibrary const>> promise;
+		Entry entry;
+		bool owner = false;
+		{
+			std::lock_guard lock(mutex);
+			auto [it, inserted] = libraries.try_emplace(key);
+			if (inserted) {
+				it->second = promise.get_future().share();
+				owner = true;
+			}
+			entry = it->second;
+		}
+
+		// Parse outside of the lock, so that different libraries are parsed
+		// concurrently.
+		if (owner) {
+			try {
+				promise.set_value(parseMtlLibrary(key));
+			} catch (...) {
+				promise.set_exception(std::current_exception());
+			}
+		}
+		return entry.get();
+	}
+};
@@ -0,0 +1,55 @@
+#include <cstdint>
+#include "material_groups.hh"
+
+std::vector<MeshData> groupByMaterial(std::vector<MeshData> const &meshes)
+{
+	// Count the triangles and vertices of every group first, so that each
+	// group is allocated once.
+	std::vector<size_t> vertexCounts;
+	std::vector<size_t> indexCounts;
+	for (MeshData const &mesh: meshes) {
+		for (Vertex const &vertex: mesh.vertices) {
+			if (vertex.material >= vertexCounts.size()) {
+				vertexCounts.resize(vertex.material + 1);
+				indexCounts.resize(vertex.material + 1);
+			}
+			++vertexCounts[vertex.material];
+		}
+		for (size_t i = 0; i < mesh.indices.size(); i += 3) {
+			++indexCounts[mesh.vertices[mesh.indices[i]].material];
+		}
+	}
+
+	std::vector<MeshData> groups(vertexCounts.size());
+	for (size_t i = 0; i < groups.size(); ++i) {
+		groups[i].vertices.reserve(vertexCounts[i]);
+		groups[i].indices.reserve(indexCounts[i] * 3);
+	}
+
+	// Index of every vertex of the current mesh in its group.
+	constexpr uint32_t NONE = UINT32_MAX;
+	std::vector<uint32_t> remap;
+	for (MeshData const &mesh: meshes) {
+		remap.assign(mesh.vertices.size(), NONE);
+		for (size_t i = 0; i < mesh.indices.size(); i += 3) {
+			MeshData &group = groups[mesh.vertices[mesh.indices[i]].material];
+			for (size_t k = i; k < i + 3; ++k) {
+				uint32_t index = mesh.indices[k];
+				if (remap[index] == NONE) {
+					remap[index] = static_cast<uint32_t>(group.vertices.size());
+					group.vertices.push_back(mesh.vertices[index]);
+				}
+				group.indices.push_back(remap[index]);
+			}
+		}
+	}
+
+	std::vector<MeshData> result;
+	for (MeshData &group: groups) {
+		if (!group.indices.empty()) {
+			group.bounds = computeBounds(group.vertices.data(), group.vertices.size());
+			result.push_back(std::move(group));
+		}
+	}
+	return result;
+}
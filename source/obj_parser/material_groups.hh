@@ -0,0 +1,11 @@
+#pragma once
+
+#include <vector>
+#include "obj_parser/mesh_data.hh"
+
+// Regroups the triangles of all meshes by material, so that every material
+// can be drawn with a single call. Returns one mesh for each material that is
+// used, ordered by material index. Triangles keep their order within a group.
+// A vertex only belongs to a single material, so vertices are shared exactly
+// as they were before.
+std::vector<MeshData> groupByMaterial(std::vector<MeshData> const &meshes);
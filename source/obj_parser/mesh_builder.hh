@@ -0,0 +1,127 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <utility>
+#include "obj_parser/mesh_data.hh"
+
+// Builds an indexed mesh from triangle corners. Corners that refer to the same
+// position, normal and material share a single vertex, which is looked up in
+// an open addressing hash table. A builder can be reused for several meshes,
+// and then keeps its memory between them.
+class MeshBuilder {
+public:
+	struct Key {
+		uint32_t position {0};
+		uint32_t normal {0};
+		uint32_t material {0};
+
+		bool operator==(Key const &other) const noexcept
+		{
+			return position == other.position && normal == other.normal && material == other.material;
+		}
+	};
+
+private:
+	static constexpr uint32_t EMPTY = UINT32_MAX;
+
+	struct Slot {
+		Key key;
+		uint32_t index {EMPTY};
+	};
+
+	std::vector<Slot> slots;
+	// The number of vertices is not known in advance, so they are collected
+	// here and copied into a vector of the right size by finish().
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+
+public:
+	explicit MeshBuilder(size_t cornerCount = 0)
+	{
+		reset(cornerCount);
+	}
+
+	// Starts a new mesh. cornerCount is used to size the index list and the
+	// hash table.
+	void reset(size_t cornerCount)
+	{
+		vertices.clear();
+		indices.clear();
+		indices.reserve(cornerCount);
+		// Most meshes share every vertex between a few corners.
+		size_t capacity = 64;
+		while (capacity < cornerCount / 2) {
+			capacity *= 2;
+		}
+		slots.assign(capacity, Slot {});
+	}
+
+	// makeVertex is only called if there is no vertex for the key yet.
+	template<typename MakeVertex>
+	void addCorner(Key const &key, MakeVertex const &makeVertex)
+	{
+		Slot *slot = find(key);
+		uint32_t index = slot->index;
+		if (index == EMPTY) {
+			index = static_cast<uint32_t>(vertices.size());
+			slot->key = key;
+			slot->index = index;
+			vertices.push_back(makeVertex());
+			if (vertices.size() * 2 > slots.size()) {
+				grow();
+			}
+		}
+		indices.push_back(index);
+	}
+
+	[[nodiscard]] bool empty() const noexcept
+	{
+		return indices.empty();
+	}
+
+	// Returns the finished mesh with its bounds. reset() has to be called
+	// before the builder is used again.
+	[[nodiscard]] MeshData finish()
+	{
+		MeshData data;
+		data.vertices.assign(vertices.begin(), vertices.end());
+		data.indices = std::move(indices);
+		data.bounds = computeBounds(data.vertices.data(), data.vertices.size());
+		vertices.clear();
+		indices.clear();
+		return data;
+	}
+
+private:
+	static size_t hash(Key const &key) noexcept
+	{
+		uint64_t h = key.position * 0x9E3779B97F4A7C15ull;
+		h ^= (h >> 29) ^ (key.normal * 0xC2B2AE3D27D4EB4Full);
+		h ^= (h >> 32) ^ (key.material * 0x165667B19E3779F9ull);
+		h ^= h >> 29;
+		return static_cast<size_t>(h);
+	}
+
+	Slot *find(Key const &key) noexcept
+	{
+		size_t mask = slots.size() - 1;
+		for (size_t i = hash(key) & mask;; i = (i + 1) & mask) {
+			Slot &slot = slots[i];
+			if (slot.index == EMPTY || slot.key == key) {
+				return &slot;
+			}
+		}
+	}
+
+	void grow()
+	{
+		std::vector<Slot> old(slots.size() * 2);
+		old.swap(slots);
+		for (Slot const &slot: old) {
+			if (slot.index != EMPTY) {
+				*find(slot.key) = slot;
+			}
+		}
+	}
+};
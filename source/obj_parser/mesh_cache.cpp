@@ -0,0 +1,303 @@
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include "mesh_cache.hh"
+#include "file_stamp.hh"
+#include "mapped_file.hh"
+
+// Increment whenever the file layout or the PackedVertex, PackedPosition,
+// PackedObject, Material or Bounds struct changes, or when the parser produces
+// different meshes for the same file.
+static constexpr uint32_t VERSION = 10;
+static constexpr char MAGIC[8] = {'V', 'W', 'A', 'M', 'E', 'S', 'H', '\0'};
+
+// All fields are stored in host byte order, and every section begins at a
+// multiple of eight bytes, so vertices can be used straight from the mapping.
+
+struct Header {
+	char magic[8];
+	uint32_t version;
+	uint32_t vertexSize;
+	uint32_t materialSize;
+	uint32_t materialCount;
+	FileStamp source;
+	uint32_t dependencyCount;
+	uint32_t geometryCount;
+	uint32_t objectCount;
+	QuantizationError quantizationError;
+};
+
+// Followed by the path of the dependency relative to the directory of the
+// model file, padded with zeros, so the model can be moved along with its
+// dependencies.
+struct DependencyEntry {
+	FileStamp stamp;
+	uint64_t pathLength;
+};
+
+// The geometry entries are followed by one PackedObject per object.
+struct GeometryEntry {
+	uint64_t vertexOffset;
+	uint64_t positionOffset;
+	uint64_t vertexCount;
+	uint64_t indexOffset;
+	uint64_t indexCount;
+	uint32_t indexType;
+	uint32_t padding;
+	Bounds bounds;
+	PositionQuantization quantization;
+};
+
+static size_t align8(size_t size)
+{
+	return (size + 7) & ~size_t(7);
+}
+
+// Returns a pointer to count elements of type T at offset and moves offset to
+// the next section, or returns nullptr if the elements would reach past the
+// end of the file.
+template<typename T>
+static T const *readSection(std::string_view bytes, size_t &offset, size_t count)
+{
+	if (offset > bytes.size() || count > (bytes.size() - offset) / sizeof(T)) {
+		return nullptr;
+	}
+	auto result = reinterpret_cast<T const *>(bytes.data() + offset);
+	offset = align8(offset + count * sizeof(T));
+	return result;
+}
+
+// Whether the indices and the materials of the vertices are within range, so
+// that a damaged cache cannot make the GPU read outside of a buffer.
+template<typename Index>
+static bool areIndicesValid(char const *indices, size_t count, size_t vertexCount)
+{
+	auto values = reinterpret_cast<Index const *>(indices);
+	return std::all_of(values, values + count, [&](Index index) { return index < vertexCount; });
+}
+
+static bool areMaterialsValid(PackedVertex const *vertices, size_t count, size_t materialCount)
+{
+	return std::all_of(vertices, vertices + count, [&](PackedVertex const &vertex) {
+		return vertex.material < materialCount;
+	});
+}
+
+std::filesystem::path getMeshCachePath(std::filesystem::path const &source)
+{
+	std::filesystem::path result = source;
+	result += ".cache";
+	return result;
+}
+
+std::optional<PackedModel> readMeshCache(
+	std::filesystem::path const &cachePath,
+	std::filesystem::path const &source)
+{
+	std::error_code error;
+	if (!std::filesystem::exists(cachePath, error)) {
+		return {};
+	}
+
+	try {
+		auto file = std::make_shared<MappedFile>(cachePath);
+		std::string_view bytes = file->view();
+		size_t offset = 0;
+
+		auto header = readSection<Header>(bytes, offset, 1);
+		if (!header || std::memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0 ||
+		    header->version != VERSION || header->vertexSize != sizeof(PackedVertex) ||
+		    header->materialSize != sizeof(Material) || !isUpToDate(header->source, source)) {
+			return {};
+		}
+
+		PackedModel model;
+		for (uint32_t i = 0; i < header->dependencyCount; ++i) {
+			auto dependency = readSection<DependencyEntry>(bytes, offset, 1);
+			auto path = dependency ? readSection<char>(bytes, offset, dependency->pathLength) : nullptr;
+			if (!path) {
+				return {};
+			}
+			model.dependencies.push_back(source.parent_path() / std::string(path, dependency->pathLength));
+			if (!isUpToDate(dependency->stamp, model.dependencies.back())) {
+				return {};
+			}
+		}
+
+		auto table = readSection<Material>(bytes, offset, header->materialCount);
+		auto entries = table ? readSection<GeometryEntry>(bytes, offset, header->geometryCount) : nullptr;
+		auto objects = entries ? readSection<PackedObject>(bytes, offset, header->objectCount) : nullptr;
+		if (!objects) {
+			return {};
+		}
+		model.source = header->source;
+		model.materials.assign(table, table + header->materialCount);
+		model.objects.assign(objects, objects + header->objectCount);
+		model.quantizationError = header->quantizationError;
+
+		for (uint32_t i = 0; i < header->geometryCount; ++i) {
+			GeometryEntry const &entry = entries[i];
+			if (entry.indexType != GL_UNSIGNED_SHORT && entry.indexType != GL_UNSIGNED_INT) {
+				return {};
+			}
+			size_t indexSize = entry.indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t);
+			// Sections that are not where writeMeshCache puts them could not
+			// be read as arrays, and the size of the indices could wrap.
+			if ((entry.vertexOffset | entry.positionOffset | entry.indexOffset) % 8 != 0 ||
+			    entry.indexCount > SIZE_MAX / indexSize) {
+				return {};
+			}
+			offset = entry.vertexOffset;
+			auto vertices = readSection<PackedVertex>(bytes, offset, entry.vertexCount);
+			offset = entry.positionOffset;
+			auto positions = readSection<PackedPosition>(bytes, offset, entry.vertexCount);
+			offset = entry.indexOffset;
+			auto indices = readSection<char>(bytes, offset, entry.indexCount * indexSize);
+			if (!vertices || !positions || !indices ||
+			    !areMaterialsValid(vertices, entry.vertexCount, header->materialCount)) {
+				return {};
+			}
+			bool valid = entry.indexType == GL_UNSIGNED_SHORT ?
+			             areIndicesValid<uint16_t>(indices, entry.indexCount, entry.vertexCount) :
+			             areIndicesValid<uint32_t>(indices, entry.indexCount, entry.vertexCount);
+			if (!valid) {
+				return {};
+			}
+
+			PackedGeometry geometry;
+			geometry.vertices = {reinterpret_cast<char const *>(vertices), entry.vertexCount * sizeof(PackedVertex)};
+			geometry.positions = {reinterpret_cast<char const *>(positions),
+			                      entry.vertexCount * sizeof(PackedPosition)};
+			geometry.indices = {indices, entry.indexCount * indexSize};
+			geometry.vertexCount = entry.vertexCount;
+			geometry.indexCount = entry.indexCount;
+			geometry.indexType = entry.indexType;
+			geometry.bounds = entry.bounds;
+			geometry.quantization = entry.quantization;
+			model.geometries.push_back(geometry);
+		}
+		for (PackedObject const &object: model.objects) {
+			if (object.geometry >= model.geometries.size()) {
+				return {};
+			}
+		}
+		model.storage = std::move(file);
+		return model;
+	} catch (std::string &) {
+		return {};
+	}
+}
+
+std::optional<Model> loadMeshCache(
+	std::filesystem::path const &cachePath,
+	std::filesystem::path const &source)
+{
+	std::optional<PackedModel> cached = readMeshCache(cachePath, source);
+	if (!cached) {
+		return {};
+	}
+	return createModel(*cached);
+}
+
+void writeMeshCache(
+	std::filesystem::path const &cachePath,
+	std::filesystem::path const &source,
+	PackedModel const &model)
+{
+	try {
+		Header header {};
+		std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+		header.version = VERSION;
+		header.vertexSize = sizeof(PackedVertex);
+		header.materialSize = sizeof(Material);
+		header.materialCount = static_cast<uint32_t>(model.materials.size());
+		header.dependencyCount = static_cast<uint32_t>(model.dependencies.size());
+		header.geometryCount = static_cast<uint32_t>(model.geometries.size());
+		header.objectCount = static_cast<uint32_t>(model.objects.size());
+		header.quantizationError = model.quantizationError;
+
+		if (!model.source) {
+			return;
+		}
+		header.source = *model.source;
+
+		std::vector<DependencyEntry> dependencies;
+		std::vector<std::string> dependencyPaths;
+		size_t offset = align8(sizeof(Header));
+		std::filesystem::path directory = std::filesystem::absolute(source).parent_path();
+		for (auto const &path: model.dependencies) {
+			std::optional<FileStamp> stamp = getFileStamp(path);
+			if (!stamp) {
+				return;
+			}
+			// Paths on another drive cannot be relative.
+			std::filesystem::path relative = std::filesystem::absolute(path).lexically_relative(directory);
+			dependencyPaths.push_back(relative.empty() ? std::filesystem::absolute(path).string() : relative.string());
+			dependencies.push_back({*stamp, dependencyPaths.back().size()});
+			offset += align8(sizeof(DependencyEntry)) + align8(dependencyPaths.back().size());
+		}
+
+		offset += align8(model.materials.size() * sizeof(Material));
+		offset += align8(model.geometries.size() * sizeof(GeometryEntry));
+		offset += align8(model.objects.size() * sizeof(PackedObject));
+		std::vector<GeometryEntry> entries;
+		for (PackedGeometry const &geometry: model.geometries) {
+			GeometryEntry entry {};
+			entry.vertexOffset = offset;
+			offset = align8(offset + geometry.vertices.size());
+			entry.positionOffset = offset;
+			offset = align8(offset + geometry.positions.size());
+			entry.indexOffset = offset;
+			offset = align8(offset + geometry.indices.size());
+			entry.vertexCount = geometry.vertexCount;
+			entry.indexCount = geometry.indexCount;
+			entry.indexType = geometry.indexType;
+			entry.bounds = geometry.bounds;
+			entry.quantization = geometry.quantization;
+			entries.push_back(entry);
+		}
+
+		// Write to a temporary file first, so that a crash never leaves a
+		// truncated cache behind.
+		std::filesystem::path temporaryPath = cachePath;
+		temporaryPath += ".tmp";
+		std::ofstream out(temporaryPath, std::ios::binary | std::ios::trunc);
+		size_t written = 0;
+		auto write = [&](void const *data, size_t size) {
+			static constexpr char zeros[8] {};
+			out.write(static_cast<char const *>(data), static_cast<std::streamsize>(size));
+			out.write(zeros, static_cast<std::streamsize>(align8(size) - size));
+			written += align8(size);
+		};
+
+		write(&header, sizeof(header));
+		for (size_t i = 0; i < dependencies.size(); ++i) {
+			write(&dependencies[i], sizeof(DependencyEntry));
+			write(dependencyPaths[i].data(), dependencyPaths[i].size());
+		}
+		write(model.materials.data(), model.materials.size() * sizeof(Material));
+		write(entries.data(), entries.size() * sizeof(GeometryEntry));
+		write(model.objects.data(), model.objects.size() * sizeof(PackedObject));
+		for (PackedGeometry const &geometry: model.geometries) {
+			write(geometry.vertices.data(), geometry.vertices.size());
+			write(geometry.positions.data(), geometry.positions.size());
+			write(geometry.indices.data(), geometry.indices.size());
+		}
+		out.close();
+
+		if (!out || written != offset) {
+			std::filesystem::remove(temporaryPath);
+			std::cout << "Could not write mesh cache: " << cachePath << '\n';
+			return;
+		}
+		std::filesystem::rename(temporaryPath, cachePath);
+	} catch (std::exception const &) {
+		std::cout << "Could not write mesh cache: " << cachePath << '\n';
+	} catch (std::string const &) {
+		std::cout << "Could not write mesh cache: " << cachePath << '\n';
+	}
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <optional>
+#include <filesystem>
+#include "model.hh"
+#include "obj_parser/packed_model.hh"
+
+// Binary cache for parsed model files. It stores the material table and the
+// geometries of the model in the form in which they are uploaded, see
+// PackedModel, so loading a model only takes a memory mapping and copies
+// straight out of it. A cache is valid as long as the model file and all of its
+// dependencies have the same size and either the same modification time or
+// the same content hash as when the cache was written.
+
+// Returns the location of the cache file for the given model file.
+std::filesystem::path getMeshCachePath(std::filesystem::path const &source);
+
+// The geometries point into a mapping of the cache, which the storage of the
+// model keeps open. The whole file is validated first, including every index
+// and material of the vertices. Returns nothing if there is no cache, or if it
+// is outdated or damaged.
+std::optional<PackedModel> readMeshCache(
+	std::filesystem::path const &cachePath,
+	std::filesystem::path const &source);
+
+// Returns nothing if there is no cache, or if it is outdated or damaged.
+std::optional<Model> loadMeshCache(
+	std::filesystem::path const &cachePath,
+	std::filesystem::path const &source);
+
+// Failing to write the cache is not an error. The model is simply parsed
+// again next time.
+void writeMeshCache(
+	std::filesystem::path const &cachePath,
+	std::filesystem::path const &source,
+	PackedModel const &model);
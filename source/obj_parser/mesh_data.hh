@@ -0,0 +1,28 @@
+#pragma once
+
+#include <vector>
+#include <filesystem>
+#include <cstdint>
+#include "obj_parser/vertex.hh"
+#include "obj_parser/bounds.hh"
+#include "obj_parser/material.hh"
+
+// Geometry of a single object, as it is uploaded to the GPU. Every three
+// indices form a triangle.
+struct MeshData {
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+	Bounds bounds;
+};
+
+// Everything that was loaded from a single model file.
+struct ModelData {
+	std::vector<MeshData> meshes;
+	// Every material that the vertices refer to. The first one is used for
+	// faces without a material.
+	std::vector<Material> materials;
+	// Other files that the meshes depend on, such as material libraries.
+	std::vector<std::filesystem::path> dependencies;
+	// Bounds of all meshes together.
+	Bounds bounds;
+};
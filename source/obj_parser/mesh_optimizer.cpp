@@ -0,0 +1,445 @@
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include "mesh_optimizer.hh"
+#include "instancing.hh"
+#include "parallel.hh"
+
+// Size of the simulated LRU cache. Larger than most hardware caches, since
+// the real ones are FIFOs, which waste some of their entries.
+static constexpr size_t CACHE_SIZE = 32;
+// Valences above this get the same score.
+static constexpr size_t MAX_VALENCE = 32;
+// Size of the FIFO cache that optimizeOverdraw assumes, the smallest one that
+// is common.
+static constexpr size_t FIFO_SIZE = 16;
+// Width and height of the grid that analyzeOverdraw rasterizes to.
+static constexpr int OVERDRAW_RESOLUTION = 256;
+
+// Scores of Forsyth's paper, tabulated by cache position and by the number of
+// remaining triangles of a vertex.
+struct ScoreTables {
+	float cache[CACHE_SIZE];
+	float valence[MAX_VALENCE + 1];
+
+	ScoreTables()
+	{
+		constexpr float CACHE_DECAY_POWER = 1.5f;
+		// The vertices of the last triangle get a fixed score, so that the
+		// next triangle does not simply reuse two of them in a strip.
+		constexpr float LAST_TRIANGLE_SCORE = 0.75f;
+		constexpr float VALENCE_BOOST_SCALE = 2.0f;
+		constexpr float VALENCE_BOOST_POWER = 0.5f;
+
+		for (size_t i = 0; i < CACHE_SIZE; ++i) {
+			if (i < 3) {
+				cache[i] = LAST_TRIANGLE_SCORE;
+			} else {
+				float scale = 1.0f / static_cast<float>(CACHE_SIZE - 3);
+				cache[i] = std::pow(1.0f - static_cast<float>(i - 3) * scale, CACHE_DECAY_POWER);
+			}
+		}
+		valence[0] = 0.0f;
+		for (size_t i = 1; i <= MAX_VALENCE; ++i) {
+			valence[i] = VALENCE_BOOST_SCALE * std::pow(static_cast<float>(i), -VALENCE_BOOST_POWER);
+		}
+	}
+};
+
+static ScoreTables const SCORES;
+
+static float vertexScore(int cachePosition, uint32_t remaining)
+{
+	if (remaining == 0) {
+		// No triangle needs the vertex anymore.
+		return -1.0f;
+	}
+	float score = cachePosition >= 0 ? SCORES.cache[cachePosition] : 0.0f;
+	return score + SCORES.valence[std::min<size_t>(remaining, MAX_VALENCE)];
+}
+
+void optimizeVertexCache(std::vector<uint32_t> &indices, size_t vertexCount)
+{
+	size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0) {
+		return;
+	}
+
+	// The triangles of every vertex. The ones that have been emitted are moved
+	// to the end of each list, past remaining[vertex].
+	std::vector<uint32_t> remaining(vertexCount, 0);
+	for (uint32_t index: indices) {
+		++remaining[index];
+	}
+	std::vector<uint32_t> offsets(vertexCount + 1, 0);
+	for (size_t i = 0; i < vertexCount; ++i) {
+		offsets[i + 1] = offsets[i] + remaining[i];
+	}
+	std::vector<uint32_t> adjacency(indices.size());
+	std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+	for (size_t i = 0; i < indices.size(); ++i) {
+		adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+	}
+
+	std::vector<int> cachePositions(vertexCount, -1);
+	std::vector<float> vertexScores(vertexCount);
+	for (size_t i = 0; i < vertexCount; ++i) {
+		vertexScores[i] = vertexScore(-1, remaining[i]);
+	}
+	std::vector<float> triangleScores(triangleCount);
+	for (size_t i = 0; i < triangleCount; ++i) {
+		triangleScores[i] = vertexScores[indices[i * 3]] + vertexScores[indices[i * 3 + 1]] +
+		                    vertexScores[indices[i * 3 + 2]];
+	}
+	std::vector<char> emitted(triangleCount, false);
+
+	// Three more entries than the cache, for the vertices that are pushed out
+	// by the newest triangle.
+	std::vector<uint32_t> cache;
+	std::vector<uint32_t> nextCache;
+	cache.reserve(CACHE_SIZE + 3);
+	nextCache.reserve(CACHE_SIZE + 3);
+
+	std::vector<uint32_t> result;
+	result.reserve(indices.size());
+	size_t best = static_cast<size_t>(std::max_element(triangleScores.begin(), triangleScores.end()) -
+	                                  triangleScores.begin());
+	// Triangles before this have all been emitted.
+	size_t scan = 0;
+
+	while (result.size() < indices.size()) {
+		if (best == SIZE_MAX) {
+			// Nothing in the cache has triangles left, so continue with the
+			// next triangle in the original order.
+			while (emitted[scan]) {
+				++scan;
+			}
+			best = scan;
+		}
+
+		uint32_t const *triangle = &indices[best * 3];
+		result.insert(result.end(), triangle, triangle + 3);
+		emitted[best] = true;
+
+		nextCache.clear();
+		for (int k = 0; k < 3; ++k) {
+			if (std::find(nextCache.begin(), nextCache.end(), triangle[k]) == nextCache.end()) {
+				nextCache.push_back(triangle[k]);
+			}
+		}
+		for (int k = 0; k < 3; ++k) {
+			// Move the triangle behind the remaining ones of the vertex.
+			uint32_t vertex = triangle[k];
+			uint32_t *begin = &adjacency[offsets[vertex]];
+			uint32_t *end = begin + remaining[vertex];
+			std::iter_swap(std::find(begin, end, static_cast<uint32_t>(best)), end - 1);
+			--remaining[vertex];
+		}
+		for (uint32_t vertex: cache) {
+			if (vertex != triangle[0] && vertex != triangle[1] && vertex != triangle[2]) {
+				nextCache.push_back(vertex);
+			}
+		}
+		std::swap(cache, nextCache);
+
+		// Update the scores of everything in the cache, including the
+		// vertices that have just fallen out of it, and find the best of
+		// their triangles.
+		best = SIZE_MAX;
+		float bestScore = -1.0f;
+		for (size_t i = 0; i < cache.size(); ++i) {
+			uint32_t vertex = cache[i];
+			int position = i < CACHE_SIZE ? static_cast<int>(i) : -1;
+			cachePositions[vertex] = position;
+			float score = vertexScore(position, remaining[vertex]);
+			float delta = score - vertexScores[vertex];
+			vertexScores[vertex] = score;
+			for (uint32_t k = offsets[vertex]; k < offsets[vertex] + remaining[vertex]; ++k) {
+				uint32_t other = adjacency[k];
+				triangleScores[other] += delta;
+				if (triangleScores[other] > bestScore) {
+					bestScore = triangleScores[other];
+					best = other;
+				}
+			}
+		}
+		if (cache.size() > CACHE_SIZE) {
+			cache.resize(CACHE_SIZE);
+		}
+	}
+
+	indices = std::move(result);
+}
+
+// Simulates a FIFO cache with size entries, which can be emptied. A vertex is
+// in the cache if fewer than size vertices have been added since it was added
+// itself.
+class FifoCache {
+	std::vector<size_t> addedAt;
+	size_t size;
+	size_t misses {0};
+	size_t emptiedAt {0};
+public:
+	FifoCache(size_t vertexCount, size_t size)
+		: addedAt(vertexCount, SIZE_MAX), size(size)
+	{
+	}
+
+	// Returns the number of vertices of the triangle that were not cached.
+	int add(uint32_t const *triangle)
+	{
+		size_t before = misses;
+		for (int k = 0; k < 3; ++k) {
+			size_t added = addedAt[triangle[k]];
+			if (added == SIZE_MAX || added < emptiedAt || misses - added >= size) {
+				addedAt[triangle[k]] = misses++;
+			}
+		}
+		return static_cast<int>(misses - before);
+	}
+
+	void clear()
+	{
+		emptiedAt = misses;
+	}
+
+	[[nodiscard]] size_t getMisses() const
+	{
+		return misses;
+	}
+};
+
+// Returns the first triangle of every cluster.
+static std::vector<size_t> findClusters(std::vector<uint32_t> const &indices, size_t vertexCount, float threshold)
+{
+	size_t triangleCount = indices.size() / 3;
+
+	// Where none of the vertices of a triangle are cached, the vertex cache
+	// optimization has started over, and so can a cluster.
+	std::vector<size_t> restarts;
+	FifoCache cache(vertexCount, FIFO_SIZE);
+	for (size_t i = 0; i < triangleCount; ++i) {
+		if (cache.add(&indices[i * 3]) == 3 || i == 0) {
+			restarts.push_back(i);
+		}
+	}
+	restarts.push_back(triangleCount);
+	double limit = threshold * static_cast<double>(cache.getMisses()) / static_cast<double>(triangleCount);
+
+	// Splitting between restarts empties the cache. A cluster ends once it
+	// has made up for that.
+	std::vector<size_t> clusters;
+	cache = FifoCache(vertexCount, FIFO_SIZE);
+	for (size_t r = 0; r + 1 < restarts.size(); ++r) {
+		size_t begin = restarts[r];
+		cache.clear();
+		clusters.push_back(begin);
+		size_t misses = 0;
+		for (size_t i = begin; i < restarts[r + 1]; ++i) {
+			misses += static_cast<size_t>(cache.add(&indices[i * 3]));
+			if (i + 1 < restarts[r + 1] && static_cast<double>(misses) <= limit * static_cast<double>(i + 1 - begin)) {
+				cache.clear();
+				begin = i + 1;
+				clusters.push_back(begin);
+				misses = 0;
+			}
+		}
+	}
+	return clusters;
+}
+
+void optimizeOverdraw(MeshData &mesh, float threshold)
+{
+	size_t triangleCount = mesh.indices.size() / 3;
+	if (triangleCount == 0) {
+		return;
+	}
+	std::vector<size_t> clusters = findClusters(mesh.indices, mesh.vertices.size(), threshold);
+	clusters.push_back(triangleCount);
+
+	// Area-weighted centroid and normal of every cluster, and the centroid
+	// of the whole mesh.
+	size_t clusterCount = clusters.size() - 1;
+	std::vector<glm::vec3> centroids(clusterCount, glm::vec3(0.0f));
+	std::vector<glm::vec3> normals(clusterCount, glm::vec3(0.0f));
+	glm::vec3 meshCentroid(0.0f);
+	float meshArea = 0.0f;
+	for (size_t cluster = 0; cluster < clusterCount; ++cluster) {
+		float area = 0.0f;
+		for (size_t i = clusters[cluster]; i < clusters[cluster + 1]; ++i) {
+			glm::vec3 const &a = mesh.vertices[mesh.indices[i * 3]].pos;
+			glm::vec3 const &b = mesh.vertices[mesh.indices[i * 3 + 1]].pos;
+			glm::vec3 const &c = mesh.vertices[mesh.indices[i * 3 + 2]].pos;
+			glm::vec3 normal = glm::cross(b - a, c - a);
+			float triangleArea = glm::length(normal);
+			centroids[cluster] += (a + b + c) * (triangleArea / 3.0f);
+			normals[cluster] += normal;
+			area += triangleArea;
+		}
+		meshCentroid += centroids[cluster];
+		meshArea += area;
+		if (area > 0.0f) {
+			centroids[cluster] /= area;
+		}
+	}
+	if (meshArea > 0.0f) {
+		meshCentroid /= meshArea;
+	}
+
+	// Clusters further out in the direction they face are drawn first.
+	std::vector<float> keys(clusterCount, 0.0f);
+	std::vector<size_t> order(clusterCount);
+	for (size_t cluster = 0; cluster < clusterCount; ++cluster) {
+		float length = glm::length(normals[cluster]);
+		if (length > 0.0f) {
+			keys[cluster] = glm::dot(centroids[cluster] - meshCentroid, normals[cluster] / length);
+		}
+		order[cluster] = cluster;
+	}
+	std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+		return keys[a] > keys[b];
+	});
+
+	std::vector<uint32_t> result;
+	result.reserve(mesh.indices.size());
+	for (size_t cluster: order) {
+		result.insert(result.end(), mesh.indices.begin() + static_cast<ptrdiff_t>(clusters[cluster] * 3),
+		              mesh.indices.begin() + static_cast<ptrdiff_t>(clusters[cluster + 1] * 3));
+	}
+	mesh.indices = std::move(result);
+}
+
+void optimizeVertexFetch(MeshData &mesh)
+{
+	constexpr uint32_t UNUSED = UINT32_MAX;
+	std::vector<uint32_t> remap(mesh.vertices.size(), UNUSED);
+	std::vector<Vertex> vertices;
+	vertices.reserve(mesh.vertices.size());
+	for (uint32_t &index: mesh.indices) {
+		if (remap[index] == UNUSED) {
+			remap[index] = static_cast<uint32_t>(vertices.size());
+			vertices.push_back(mesh.vertices[index]);
+		}
+		index = remap[index];
+	}
+	mesh.vertices = std::move(vertices);
+}
+
+void optimizeMesh(MeshData &mesh)
+{
+	optimizeVertexCache(mesh.indices, mesh.vertices.size());
+	optimizeOverdraw(mesh);
+	optimizeVertexFetch(mesh);
+}
+
+std::vector<MeshInstances> optimizeMeshes(std::vector<MeshData> &meshes, unsigned threadCount)
+{
+	if (threadCount == 0) {
+		threadCount = util::hardwareThreadCount();
+	}
+	// Copies get the triangle order of the first mesh, rather than their own
+	// one, which may differ where the overdraw order is decided by rounding.
+	// So they are still found as copies afterwards.
+	std::vector<MeshInstances> instances = findInstances(meshes);
+	util::parallelFor(instances.size(), threadCount, [&](size_t i) {
+		std::vector<size_t> const &copies = instances[i].meshes;
+		MeshData &first = meshes[copies[0]];
+		optimizeVertexCache(first.indices, first.vertices.size());
+		optimizeOverdraw(first);
+		for (size_t k = 1; k < copies.size(); ++k) {
+			meshes[copies[k]].indices = first.indices;
+			optimizeVertexFetch(meshes[copies[k]]);
+		}
+		optimizeVertexFetch(first);
+	});
+	return instances;
+}
+
+VertexCacheStats analyzeVertexCache(std::vector<uint32_t> const &indices, size_t vertexCount, size_t cacheSize)
+{
+	FifoCache cache(vertexCount, cacheSize);
+	for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+		cache.add(&indices[i]);
+	}
+	size_t misses = cache.getMisses();
+
+	VertexCacheStats stats;
+	if (!indices.empty()) {
+		stats.acmr = static_cast<double>(misses) / static_cast<double>(indices.size() / 3);
+	}
+	if (vertexCount > 0) {
+		stats.atvr = static_cast<double>(misses) / static_cast<double>(vertexCount);
+	}
+	return stats;
+}
+
+OverdrawStats analyzeOverdraw(MeshData const &mesh)
+{
+	OverdrawStats stats;
+	if (mesh.indices.empty()) {
+		return stats;
+	}
+	Bounds bounds = computeBounds(mesh.vertices.data(), mesh.vertices.size());
+	glm::vec3 extent = bounds.max - bounds.min;
+	float scale = static_cast<float>(OVERDRAW_RESOLUTION) / std::max({extent.x, extent.y, extent.z, 1e-20f});
+
+	std::vector<float> depths(OVERDRAW_RESOLUTION * OVERDRAW_RESOLUTION);
+	for (int axis = 0; axis < 3; ++axis) {
+		for (float sign: {-1.0f, 1.0f}) {
+			// Looking along direction, with the other two axes on the grid.
+			glm::vec3 direction(0.0f);
+			direction[axis] = sign;
+			int u = (axis + 1) % 3;
+			int v = (axis + 2) % 3;
+			std::fill(depths.begin(), depths.end(), std::numeric_limits<float>::infinity());
+
+			for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+				glm::vec3 corners[3];
+				for (int k = 0; k < 3; ++k) {
+					corners[k] = mesh.vertices[mesh.indices[i + k]].pos;
+				}
+				if (glm::dot(glm::cross(corners[1] - corners[0], corners[2] - corners[0]), direction) >= 0.0f) {
+					continue;
+				}
+				glm::vec2 points[3];
+				float depth[3];
+				for (int k = 0; k < 3; ++k) {
+					glm::vec3 offset = (corners[k] - bounds.min) * scale;
+					points[k] = {offset[u], offset[v]};
+					depth[k] = glm::dot(corners[k], direction);
+				}
+				auto edge = [](glm::vec2 a, glm::vec2 b, glm::vec2 p) {
+					return (b.x - a.x) * (p.y - a.y) - (b.y - a.y) * (p.x - a.x);
+				};
+				float area = edge(points[0], points[1], points[2]);
+				if (area == 0.0f) {
+					continue;
+				}
+				int x0 = std::max(0, static_cast<int>(std::min({points[0].x, points[1].x, points[2].x})));
+				int y0 = std::max(0, static_cast<int>(std::min({points[0].y, points[1].y, points[2].y})));
+				int x1 = std::min(OVERDRAW_RESOLUTION - 1, static_cast<int>(std::max({points[0].x, points[1].x, points[2].x})));
+				int y1 = std::min(OVERDRAW_RESOLUTION - 1, static_cast<int>(std::max({points[0].y, points[1].y, points[2].y})));
+				for (int y = y0; y <= y1; ++y) {
+					for (int x = x0; x <= x1; ++x) {
+						glm::vec2 p(static_cast<float>(x) + 0.5f, static_cast<float>(y) + 0.5f);
+						float w0 = edge(points[1], points[2], p) / area;
+						float w1 = edge(points[2], points[0], p) / area;
+						float w2 = edge(points[0], points[1], p) / area;
+						if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f) {
+							continue;
+						}
+						float z = w0 * depth[0] + w1 * depth[1] + w2 * depth[2];
+						float &stored = depths[static_cast<size_t>(y * OVERDRAW_RESOLUTION + x)];
+						if (z < stored) {
+							stats.covered += stored == std::numeric_limits<float>::infinity();
+							stored = z;
+							++stats.shaded;
+						}
+					}
+				}
+			}
+		}
+	}
+	return stats;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include "obj_parser/mesh_data.hh"
+#include "obj_parser/instancing.hh"
+
+// Reorders triangles so that the GPU's post-transform vertex cache is hit
+// more often, with Tom Forsyth's linear-speed algorithm. Every vertex gets a
+// score from its position in a simulated LRU cache and from the number of
+// triangles that still use it, and the triangle with the highest sum is
+// emitted next. The winding of every triangle is kept.
+void optimizeVertexCache(std::vector<uint32_t> &indices, size_t vertexCount);
+
+// Reorders clusters of triangles so that those facing outwards are drawn
+// first, which hides more of the triangles behind them from most viewpoints,
+// after Sander et al., "Fast Triangle Reordering for Vertex Locality and
+// Reduced Overdraw". Expects indices that are optimized for the vertex cache
+// already. They are split into clusters at the points where the cache starts
+// over anyway, and where the cache miss ratio of a cluster is at most
+// threshold times the one of the whole mesh. So the vertex cache efficiency
+// gets at most that much worse.
+void optimizeOverdraw(MeshData &mesh, float threshold = 1.05f);
+
+// Reorders the vertices in the order in which the indices first use them, so
+// that vertex fetches read memory mostly sequentially.
+void optimizeVertexFetch(MeshData &mesh);
+
+// All of the above, in that order. The result only depends on the mesh.
+void optimizeMesh(MeshData &mesh);
+
+// Optimizes the meshes on threadCount threads (0 means one per hardware
+// thread). Copies of a mesh, see findInstances, are only optimized once and
+// stay copies. Returns the copies that it has found.
+std::vector<MeshInstances> optimizeMeshes(std::vector<MeshData> &meshes, unsigned threadCount = 0);
+
+struct VertexCacheStats {
+	// Average cache miss ratio: transformed vertices per triangle. Between 0.5
+	// for an ideal regular grid and 3.
+	double acmr {0.0};
+	// Average transformed vertex ratio: transformed vertices per vertex. 1 is
+	// the optimum.
+	double atvr {0.0};
+};
+
+// Simulates a FIFO cache with cacheSize entries, as most GPUs have.
+[[nodiscard]] VertexCacheStats analyzeVertexCache(
+	std::vector<uint32_t> const &indices,
+	size_t vertexCount,
+	size_t cacheSize = 32);
+
+struct OverdrawStats {
+	// Pixels that the mesh covers.
+	size_t covered {0};
+	// Fragments that pass the depth test, and would be shaded with an early
+	// depth test.
+	size_t shaded {0};
+
+	// Shaded fragments per covered pixel. 1 is the optimum.
+	[[nodiscard]] double overdraw() const noexcept
+	{
+		return covered > 0 ? static_cast<double>(shaded) / static_cast<double>(covered) : 0.0;
+	}
+};
+
+// Rasterizes the mesh in the order of its indices, with back faces culled,
+// from both sides of every axis, and adds up the results.
+[[nodiscard]] OverdrawStats analyzeOverdraw(MeshData const &mesh);
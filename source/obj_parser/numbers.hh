@@ -0,0 +1,33 @@
+#pragma once
+
+#include <charconv>
+#include <string_view>
+
+// Locale-independent number parsing over raw character ranges. parseFloat and
+// parseIndex only succeed if the whole range was consumed. Floats are rounded
+// correctly, so the results are bit-identical to what strtof or std::istream
+// produce.
+
+inline bool parseFloat(std::string_view s, float &out) noexcept
+{
+	// Unlike strtof, std::from_chars does not accept an explicit plus sign.
+	if (!s.empty() && s.front() == '+') {
+		s.remove_prefix(1);
+	}
+	auto [end, error] = std::from_chars(s.data(), s.data() + s.size(), out);
+	return error == std::errc() && end == s.data() + s.size();
+}
+
+inline bool parseIndex(std::string_view s, long &out) noexcept
+{
+	auto [end, error] = std::from_chars(s.data(), s.data() + s.size(), out);
+	return error == std::errc() && end == s.data() + s.size();
+}
+
+// Parses an index at the beginning of [begin, end) and returns a pointer past
+// it, or nullptr if there is none.
+inline char const *parseIndexPrefix(char const *begin, char const *end, long &out) noexcept
+{
+	auto [next, error] = std::from_chars(begin, end, out);
+	return error == std::errc() ? next : nullptr;
+}
@@ -0,0 +1,142 @@
+#include <cstring>
+#include "packed_model.hh"
+#include "parallel.hh"
+
+// The arrays that a packed geometry points to.
+struct PackedArrays {
+	std::vector<PackedVertex> vertices;
+	std::vector<PackedPosition> positions;
+	std::vector<char> indices;
+};
+
+template<typename T>
+static std::string_view asBytes(std::vector<T> const &values)
+{
+	return {reinterpret_cast<char const *>(values.data()), values.size() * sizeof(T)};
+}
+
+template<typename Index>
+static std::vector<char> narrowIndices(std::vector<uint32_t> const &indices)
+{
+	std::vector<char> bytes(indices.size() * sizeof(Index));
+	for (size_t i = 0; i < indices.size(); ++i) {
+		auto index = static_cast<Index>(indices[i]);
+		std::memcpy(&bytes[i * sizeof(Index)], &index, sizeof(index));
+	}
+	return bytes;
+}
+
+template<typename Index>
+static void widenIndices(std::string_view bytes, size_t count, std::vector<uint32_t> &indices)
+{
+	auto narrow = reinterpret_cast<Index const *>(bytes.data());
+	indices.assign(narrow, narrow + count);
+}
+
+// Packs the vertices within the bounds of the mesh, and narrows the indices
+// to 16 bits if possible.
+static PackedGeometry packGeometry(MeshData const &mesh, PackedArrays &arrays, QuantizationError &error)
+{
+	PackedGeometry geometry;
+	geometry.vertexCount = mesh.vertices.size();
+	geometry.indexCount = mesh.indices.size();
+	geometry.bounds = mesh.bounds;
+	geometry.quantization = PositionQuantization::fromBounds(mesh.bounds);
+
+	arrays.vertices = packVertices(mesh.vertices.data(), mesh.vertices.size(), geometry.quantization);
+	error = measureQuantizationError(mesh.vertices.data(), arrays.vertices.data(), arrays.vertices.size(),
+	                                 mesh.bounds);
+	arrays.positions = packPositions(arrays.vertices.data(), arrays.vertices.size());
+	if (mesh.vertices.size() <= UINT16_MAX + 1) {
+		geometry.indexType = GL_UNSIGNED_SHORT;
+		arrays.indices = narrowIndices<uint16_t>(mesh.indices);
+	} else {
+		geometry.indexType = GL_UNSIGNED_INT;
+		arrays.indices = narrowIndices<uint32_t>(mesh.indices);
+	}
+	geometry.vertices = asBytes(arrays.vertices);
+	geometry.positions = asBytes(arrays.positions);
+	geometry.indices = asBytes(arrays.indices);
+	return geometry;
+}
+
+PackedModel packModel(ModelData const &model, std::vector<MeshInstances> const &instances, unsigned threadCount)
+{
+	if (threadCount == 0) {
+		threadCount = util::hardwareThreadCount();
+	}
+	auto arrays = std::make_shared<std::vector<PackedArrays>>(instances.size());
+	PackedModel result;
+	result.geometries.resize(instances.size());
+	result.objects.resize(model.meshes.size());
+	std::vector<QuantizationError> errors(instances.size());
+	util::parallelFor(instances.size(), threadCount, [&](size_t i) {
+		MeshData const &mesh = model.meshes[instances[i].meshes[0]];
+		result.geometries[i] = packGeometry(mesh, (*arrays)[i], errors[i]);
+		for (size_t k = 0; k < instances[i].meshes.size(); ++k) {
+			result.objects[instances[i].meshes[k]] = {static_cast<uint32_t>(i), instances[i].transforms[k]};
+		}
+	});
+
+	for (QuantizationError const &error: errors) {
+		result.quantizationError.merge(error);
+	}
+	result.materials = model.materials;
+	result.dependencies = model.dependencies;
+	result.storage = std::move(arrays);
+	return result;
+}
+
+PackedModel packMesh(MeshData const &mesh)
+{
+	auto arrays = std::make_shared<PackedArrays>();
+	PackedModel result;
+	result.geometries.push_back(packGeometry(mesh, *arrays, result.quantizationError));
+	result.objects.emplace_back();
+	result.storage = std::move(arrays);
+	return result;
+}
+
+MeshData unpackObject(PackedModel const &model, size_t object)
+{
+	PackedObject const &instance = model.objects[object];
+	PackedGeometry const &geometry = model.geometries[instance.geometry];
+	auto vertices = reinterpret_cast<PackedVertex const *>(geometry.vertices.data());
+	// Transforms only rotate and scale uniformly, so normals only have to be
+	// normalized again.
+	glm::mat3 rotation(instance.transform);
+
+	MeshData mesh;
+	mesh.vertices.resize(geometry.vertexCount);
+	for (size_t i = 0; i < geometry.vertexCount; ++i) {
+		Vertex &vertex = mesh.vertices[i];
+		glm::vec3 position = unpackPosition(vertices[i], geometry.quantization);
+		vertex.pos = glm::vec3(instance.transform * glm::vec4(position, 1.0f));
+		glm::vec3 normal = rotation * unpackNormal(vertices[i].normal);
+		float length = glm::length(normal);
+		vertex.normal = length > 0.0f ? normal / length : normal;
+		vertex.material = vertices[i].material;
+	}
+	if (geometry.indexType == GL_UNSIGNED_SHORT) {
+		widenIndices<uint16_t>(geometry.indices, geometry.indexCount, mesh.indices);
+	} else {
+		widenIndices<uint32_t>(geometry.indices, geometry.indexCount, mesh.indices);
+	}
+	mesh.bounds = computeBounds(mesh.vertices.data(), mesh.vertices.size());
+	return mesh;
+}
+
+Model createModel(PackedModel const &packed)
+{
+	Model model;
+	for (PackedObject const &object: packed.objects) {
+		PackedGeometry const &geometry = packed.geometries[object.geometry];
+		Mesh mesh(model.geometry, geometry.vertices.data(), geometry.vertices.size(), geometry.vertexCount,
+		          VertexLayout::packed(geometry.quantization), geometry.positions.data(), geometry.indices.data(),
+		          geometry.indexCount, geometry.indexType, geometry.bounds);
+		mesh.setModelMatrix(object.transform);
+		model.addMesh(std::move(mesh));
+	}
+	model.materials.upload(packed.materials);
+	return model;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <optional>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <filesystem>
+#include <glad.h>
+#include <glm/glm.hpp>
+#include "model.hh"
+#include "packed_vertex.hh"
+#include "obj_parser/mesh_data.hh"
+#include "obj_parser/instancing.hh"
+#include "obj_parser/file_stamp.hh"
+
+// Geometry in the form in which it is uploaded: PackedVertex, PackedPosition
+// and indices that are 16-bit whenever all vertices can be addressed with
+// them. The arrays are views into the storage of the PackedModel.
+struct PackedGeometry {
+	std::string_view vertices;
+	std::string_view positions;
+	std::string_view indices;
+	size_t vertexCount {0};
+	size_t indexCount {0};
+	GLenum indexType {GL_UNSIGNED_INT};
+	// In model space, before quantization.
+	Bounds bounds;
+	PositionQuantization quantization;
+};
+
+// An object of a model file, whose geometry may be shared with others.
+struct PackedObject {
+	uint32_t geometry {0};
+	// Maps the geometry to the object, see findInstances.
+	glm::mat4 transform {1.0f};
+};
+
+// A parsed model file in the form in which it is cached and uploaded, see
+// readMeshCache.
+struct PackedModel {
+	// Owns the arrays of the geometries, which is either a mapping of the cache
+	// file or the arrays that packModel has created.
+	std::shared_ptr<void const> storage;
+	std::vector<PackedGeometry> geometries;
+	// One for every object of the file, in its order.
+	std::vector<PackedObject> objects;
+	std::vector<Material> materials;
+	// Other files that the model depends on, see ModelData.
+	std::vector<std::filesystem::path> dependencies;
+	// Of the model file, taken before it was read, so that changes during a
+	// parse are not missed. Models without one are not cached.
+	std::optional<FileStamp> source;
+	// Of all geometries, compared to the parsed vertices.
+	QuantizationError quantizationError;
+};
+
+// Packs the meshes of a parsed model on threadCount threads (0 means one per
+// hardware thread). Copies of a mesh share the geometry of the first one.
+PackedModel packModel(ModelData const &model, std::vector<MeshInstances> const &instances, unsigned threadCount = 0);
+
+// Packs a single mesh into a model with one object and no materials.
+PackedModel packMesh(MeshData const &mesh);
+
+// The vertices of an object in the space of the model file, for regrouping
+// cached meshes. They have been quantized once already, see PackedVertex.
+MeshData unpackObject(PackedModel const &model, size_t object);
+
+// Uploads every object as a mesh of its own, with the transform of the object
+// as its model matrix.
+Model createModel(PackedModel const &model);
@@ -1,156 +1,1001 @@
-#include <fstream>
+#include <map>
+#include <mutex>
 #include <string>
+#include <numeric>
+#include <utility>
+#include <optional>
+#include <algorithm>
 #include <unordered_map>
+#include <memory_resource>
 #include <glm/vec3.hpp>
+#include <glm/trigonometric.hpp>
 #include "parser.hh"
+#include "mesh_builder.hh"
+#include "mesh_cache.hh"
+#include "mesh_optimizer.hh"
+#include "mapped_file.hh"
+#include "compressed_file.hh"
+#include "material.hh"
+#include "reader.hh"
+#include "smooth_normals.hh"
+#include "gltf/glb_reader.hh"
+#include "parallel.hh"
 #include "util.hh"
 
-static glm::vec3 readVector3(std::istream &stream)
+std::unique_ptr<MaterialLibrary> parseMtlLibrary(std::filesystem::path const &path)
 {
-	glm::vec3 v;
-	stream >> v.x;
-	stream >> v.y;
-	stream >> v.z;
-	return v;
+	auto result = std::make_unique<MaterialLibrary>();
+	std::string_view materialName;
+	// Material libraries are small, so compressed ones are simply
+	// decompressed into memory as a whole.
+	std::optional<MappedFile> file;
+	std::string decompressed;
+	std::string_view text;
+	if (isCompressedFile(path)) {
+		decompressed = readDecompressedFile(path);
+		text = decompressed;
+	} else {
+		text = file.emplace(path).view();
+	}
+	Tokenizer tokens(text);
+
+	while (!tokens.atEnd() && !tokens.fail()) {
+		std::string_view token = tokens.nextToken();
+		if (token == "newmtl") {
+			materialName = tokens.nextToken();
+		} else if (token == "Kd") {
+			(*result)[materialName].diffuse = readVector3(tokens);
+		}
+		tokens.skipLine();
+	}
+
+	if (tokens.fail()) {
+		util::fatalError("Could not parse material library: ", path);
+	}
+
+	return result;
 }
 
-static bool isNumeric(int c)
+// Tracks the active material library and material, and interns every material
+// that is used into a dense table. Indexes are never reused, not even after a
+// new library is loaded, since the same name may refer to a different color.
+// Faces before the first usemtl statement use the default material at index 0.
+// Libraries are taken from the cache if there is one. The names of the
+// materials are copied into the arena of the parse.
+struct MaterialState {
+	MaterialLibraryCache *cache {nullptr};
+	std::pmr::memory_resource &arena;
+	std::shared_ptr<MaterialLibrary const> library {std::make_shared<MaterialLibrary const>()};
+	std::vector<std::filesystem::path> loadedLibraries;
+	std::pmr::unordered_map<std::string_view, uint32_t> ids;
+	std::vector<Material> table {Material {}};
+	// Index in loadedLibraries and name of every entry of the table, so that
+	// the colors can be read again later. The names point into the arena.
+	std::vector<std::pair<size_t, std::string_view>> sources {{NO_LIBRARY, {}}};
+	uint32_t currentId {0};
+
+	static constexpr size_t NO_LIBRARY = SIZE_MAX;
+
+	MaterialState(MaterialLibraryCache *cache, std::pmr::memory_resource &arena)
+		: cache(cache), arena(arena), ids(&arena)
+	{
+	}
+
+	void loadLibrary(std::filesystem::path const &path)
+	{
+		if (cache) {
+			library = cache->get(path);
+		} else {
+			library = parseMtlLibrary(path);
+		}
+		loadedLibraries.push_back(path);
+		ids.clear();
+	}
+
+	void use(std::string_view name)
+	{
+		auto it = ids.find(name);
+		if (it == ids.end()) {
+			std::string_view key = util::intern(name, arena);
+			it = ids.emplace(key, static_cast<uint32_t>(table.size())).first;
+			Material const *material = library->find(name);
+			table.push_back(material ? *material : Material {});
+			sources.emplace_back(loadedLibraries.empty() ? NO_LIBRARY : loadedLibraries.size() - 1, key);
+		}
+		currentId = it->second;
+	}
+};
+
+static void addCorner(
+	MeshBuilder &builder,
+	Corner corner,
+	std::vector<glm::vec3> const &positions,
+	std::vector<glm::vec3> const &normals,
+	uint32_t materialId)
 {
-	return (c >= '0' && c <= '9') || c == '-';
+	MeshBuilder::Key key;
+	key.position = static_cast<uint32_t>(corner.position);
+	key.normal = static_cast<uint32_t>(corner.normal);
+	key.material = materialId;
+	builder.addCorner(key, [&] {
+		return Vertex {positions[corner.position], normals[corner.normal], materialId};
+	});
 }
 
-static std::istream &whitespace(std::istream &stream)
+// Faces in the same smoothing group that meet at a sharper angle than this
+// keep a hard edge when normals are generated.
+static float const CREASE_ANGLE = glm::radians(60.0f);
+
+// Generates the missing normals of the triangles and builds the mesh. The
+// generated normals are removed from normals again afterwards, since normals
+// that the file defines later must get the indexes that it refers to them by.
+static MeshData buildMesh(
+	MeshBuilder &builder,
+	TriangleList &triangles,
+	std::vector<glm::vec3> const &positions,
+	std::vector<glm::vec3> &normals,
+	unsigned threadCount)
 {
-	// Raw std::ws is unusable because it sets failbit if stream is already in
-	// eof state before it could read any characters.
-	if (!stream.eof()) {
-		stream >> std::ws;
+	size_t normalCount = normals.size();
+	generateNormals(triangles, positions, normals, CREASE_ANGLE, threadCount);
+	builder.reset(triangles.corners.size());
+	for (size_t i = 0; i < triangles.corners.size(); ++i) {
+		addCorner(builder, triangles.corners[i], positions, normals, triangles.materials[i / 3]);
 	}
-	return stream;
+	normals.resize(normalCount);
+	return builder.finish();
 }
 
-struct Material {
-	glm::vec3 diffuse {0.8f, 0.8f, 0.8f};
+// Number of elements in (a part of) an OBJ file, used to size all lists
+// exactly before parsing.
+struct ElementCounts {
+	size_t positions {0};
+	size_t normals {0};
+	// Number of corners after triangulation for every object that has faces,
+	// in the same order in which the parser emits meshes.
+	std::vector<size_t> objectCorners;
 };
 
-using MaterialLibrary = std::unordered_map<std::string, Material>;
+// Returns the number of corners after triangulation of the face on the
+// current line, after the f token. See ObjReader::readFace.
+static size_t countTriangleCorners(Tokenizer &tokens)
+{
+	size_t corners = 0;
+	tokens.nextToken();
+	tokens.nextToken();
+	tokens.skipBlanks();
+	while (isNumeric(tokens.peek())) {
+		tokens.nextToken();
+		corners += 3;
+		tokens.skipBlanks();
+	}
+	return corners;
+}
+
+// A quick pass that only looks at the first token of each line, and at the
+// number of corners on face lines. It follows the same rules as the parser,
+// so the counts are exact for well-formed files.
+static ElementCounts countElements(std::string_view text)
+{
+	ElementCounts counts;
+	size_t corners = 0;
+
+	Tokenizer tokens(text);
+	while (!tokens.atEnd()) {
+		std::string_view token = tokens.nextToken();
+		if (token == "v") {
+			++counts.positions;
+		} else if (token == "vn") {
+			++counts.normals;
+		} else if (token == "f") {
+			corners += countTriangleCorners(tokens);
+		} else if (token == "o") {
+			if (corners > 0) {
+				counts.objectCorners.push_back(corners);
+				corners = 0;
+			}
+		}
+		tokens.skipLine();
+	}
+	if (corners > 0) {
+		counts.objectCorners.push_back(corners);
+	}
+
+	return counts;
+}
 
-static MaterialLibrary parseMtlLibrary(std::filesystem::path const &path)
+static Bounds getModelBounds(std::vector<MeshData> const &meshes)
 {
-	MaterialLibrary result;
-	std::string materialName;
-	std::ifstream file(path);
-	if (!file.is_open()) {
-		util::fatalError("Could not open MTL file: ", path);
+	Bounds result;
+	for (auto const &mesh: meshes) {
+		result = mergeBounds(result, mesh.bounds);
 	}
+	return result;
+}
 
-	while (file.good()) {
-		std::string token;
-		file >> token;
-		if (token == "newmtl") {
-			file >> materialName;
-		} else if (token == "Kd") {
-			result[materialName].diffuse = readVector3(file);
+// Builds the meshes of a whole file in a single pass.
+class ModelBuilder: public ObjVisitor {
+	std::filesystem::path const &path;
+	ElementCounts const &counts;
+	// Begin with a dummy value, because OBJ indexes begin at 1.
+	std::vector<glm::vec3> positions;
+	std::vector<glm::vec3> normals;
+	std::vector<MeshData> meshes;
+	// Temporaries of the parse that are released together with the builder.
+	std::pmr::monotonic_buffer_resource arena;
+	MaterialState materials;
+	// Faces before the first s statement are smoothed, so that files
+	// without normals and smoothing groups do not look faceted.
+	uint32_t smoothingGroup {1};
+	// Triangles of the current object.
+	TriangleList triangles;
+	MeshBuilder meshBuilder;
+	unsigned threadCount;
+public:
+	ModelBuilder(
+		std::filesystem::path const &path,
+		ElementCounts const &counts,
+		unsigned threadCount,
+		MaterialLibraryCache *libraries)
+		: path(path), counts(counts), positions(1), normals(1), materials(libraries, arena), threadCount(threadCount)
+	{
+		positions.reserve(counts.positions + 1);
+		normals.reserve(counts.normals + 1);
+		meshes.reserve(counts.objectCorners.size());
+		reserveTriangles();
+	}
+
+	void onPosition(glm::vec3 const &position)
+	{
+		positions.push_back(position);
+	}
+
+	void onNormal(glm::vec3 const &normal)
+	{
+		normals.push_back(normal);
+	}
+
+	void onFace(Corner const *corners, size_t count)
+	{
+		triangulate(corners, count, [&](Corner a, Corner b, Corner c) {
+			triangles.corners.insert(triangles.corners.end(), {a, b, c});
+			triangles.materials.push_back(materials.currentId);
+			triangles.smoothingGroups.push_back(smoothingGroup);
+		});
+	}
+
+	void onObject(std::string_view)
+	{
+		if (!triangles.empty()) {
+			meshes.push_back(buildMesh(meshBuilder, triangles, positions, normals, threadCount));
+			// Keep the memory for the next object.
+			triangles.clear();
+			reserveTriangles();
 		}
-		file.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-		file >> whitespace;
 	}
 
-	if (file.fail()) {
-		util::fatalError("Could not parse material library: ", path);
+	void onMaterialLibrary(std::string_view name)
+	{
+		materials.loadLibrary(path.parent_path().append(name));
 	}
 
-	return result;
+	void onMaterial(std::string_view name)
+	{
+		materials.use(name);
+	}
+
+	void onSmoothingGroup(uint32_t group)
+	{
+		smoothingGroup = group;
+	}
+
+	ModelData finish()
+	{
+		onObject({});
+		Bounds bounds = getModelBounds(meshes);
+		return {std::move(meshes), std::move(materials.table), std::move(materials.loadedLibraries), bounds};
+	}
+
+private:
+	void reserveTriangles()
+	{
+		size_t next = meshes.size();
+		size_t corners = next < counts.objectCorners.size() ? counts.objectCorners[next] : 0;
+		triangles.corners.reserve(corners);
+		triangles.materials.reserve(corners / 3);
+		triangles.smoothingGroups.reserve(corners / 3);
+	}
+};
+
+static ModelData parseSerial(
+	std::filesystem::path const &path,
+	std::string_view text,
+	unsigned threadCount,
+	MaterialLibraryCache *libraries)
+{
+	ElementCounts counts = countElements(text);
+	ModelBuilder builder(path, counts, threadCount, libraries);
+	ObjReader reader;
+	reader.read(text, builder);
+	if (reader.fail()) {
+		util::fatalError("Could not parse file: ", path);
+	}
+	return builder.finish();
 }
 
-static Vertex readVertex(
-	std::istream &stream,
-	std::vector<glm::vec3> const &positions,
-	std::vector<glm::vec3> const &normals,
-	Material const &material)
+// Parses a compressed file while it is being decompressed. The element counts
+// are not known in advance, so the arrays simply grow as needed.
+static ModelData parseCompressed(
+	std::filesystem::path const &path,
+	unsigned threadCount,
+	MaterialLibraryCache *libraries)
 {
-	size_t indices[3] {0, 0, 0};
-	for (int i = 0; i < 3; ++i) {
-		if (i == 0 || isNumeric(stream.peek())) {
-			stream >> indices[i];
-		}
-		if (stream.peek() == '/') {
-			stream.ignore(1);
+	ElementCounts counts;
+	ModelBuilder builder(path, counts, threadCount, libraries);
+	DecompressionStream stream(path);
+	if (!readObjBlocks([&] { return stream.next(); }, builder)) {
+		util::fatalError("Could not parse file: ", path);
+	}
+	return builder.finish();
+}
+
+// Statements that affect how faces are grouped, and which material and
+// smoothing group they use. They have to be replayed in file order after all
+// chunks have been parsed.
+struct ChunkEvent {
+	enum Type {
+		NEW_OBJECT,
+		LOAD_LIBRARY,
+		USE_MATERIAL,
+		SMOOTHING_GROUP
+	} type;
+	// Number of corners in the chunk before this statement.
+	size_t corner;
+	// Points into the mapped file.
+	std::string_view name;
+	uint32_t smoothingGroup {0};
+};
+
+struct Chunk {
+	std::string_view text;
+	// Sizes of the global position and normal lists before this chunk,
+	// including the dummy values.
+	size_t positionBase {0};
+	size_t normalBase {0};
+	ElementCounts counts;
+	// Three consecutive corners form a triangle.
+	std::vector<Corner> corners;
+	std::vector<ChunkEvent> events;
+	bool failed {false};
+};
+
+// A run of corners inside a chunk that share their material, smoothing group
+// and mesh.
+struct Segment {
+	Chunk const *chunk;
+	size_t begin;
+	size_t end;
+	uint32_t materialId;
+	uint32_t smoothingGroup;
+};
+
+static std::vector<Chunk> splitIntoChunks(std::string_view text, size_t chunkCount)
+{
+	std::vector<Chunk> chunks;
+	size_t begin = 0;
+	for (size_t i = 1; i <= chunkCount && begin < text.size(); ++i) {
+		size_t end = text.size();
+		if (i < chunkCount) {
+			end = text.find('\n', std::max(begin, text.size() / chunkCount * i));
+			end = end == std::string_view::npos ? text.size() : end + 1;
 		}
+		Chunk chunk;
+		chunk.text = text.substr(begin, end - begin);
+		chunks.push_back(std::move(chunk));
+		begin = end;
+	}
+	return chunks;
+}
+
+// Writes positions and normals directly into their final place in the global
+// lists. Face indexes are already global, since the reader starts counting at
+// the bases of the chunk.
+class ChunkParser: public ObjVisitor {
+	Chunk &chunk;
+	glm::vec3 *positions;
+	glm::vec3 *normals;
+public:
+	ChunkParser(Chunk &chunk, std::vector<glm::vec3> &positions, std::vector<glm::vec3> &normals)
+		: chunk(chunk), positions(&positions[chunk.positionBase]), normals(&normals[chunk.normalBase])
+	{
+	}
+
+	void onPosition(glm::vec3 const &position)
+	{
+		*positions++ = position;
+	}
+
+	void onNormal(glm::vec3 const &normal)
+	{
+		*normals++ = normal;
+	}
+
+	void onFace(Corner const *corners, size_t count)
+	{
+		triangulate(corners, count, [&](Corner a, Corner b, Corner c) {
+			chunk.corners.push_back(a);
+			chunk.corners.push_back(b);
+			chunk.corners.push_back(c);
+		});
 	}
-	if (indices[0] < 0) {
-		indices[0] += positions.size();
+
+	void onObject(std::string_view)
+	{
+		chunk.events.push_back({ChunkEvent::NEW_OBJECT, chunk.corners.size(), {}});
+	}
+
+	void onMaterialLibrary(std::string_view name)
+	{
+		chunk.events.push_back({ChunkEvent::LOAD_LIBRARY, chunk.corners.size(), name});
+	}
+
+	void onMaterial(std::string_view name)
+	{
+		chunk.events.push_back({ChunkEvent::USE_MATERIAL, chunk.corners.size(), name});
+	}
+
+	void onSmoothingGroup(uint32_t group)
+	{
+		chunk.events.push_back({ChunkEvent::SMOOTHING_GROUP, chunk.corners.size(), {}, group});
 	}
-	if (indices[2] < 0) {
-		indices[2] += normals.size();
+};
+
+static void parseChunk(Chunk &chunk, std::vector<glm::vec3> &positions, std::vector<glm::vec3> &normals)
+{
+	size_t cornerCount = 0;
+	for (size_t corners: chunk.counts.objectCorners) {
+		cornerCount += corners;
 	}
-	return {positions[indices[0]], normals[indices[2]], material.diffuse};
+	chunk.corners.reserve(cornerCount);
+
+	ChunkParser parser(chunk, positions, normals);
+	ObjReader reader(chunk.positionBase, chunk.normalBase);
+	reader.read(chunk.text, parser);
+	chunk.failed = reader.fail();
 }
 
-std::vector<Mesh> loadMeshesFromFile(std::filesystem::path const &path)
+static ModelData parseParallel(
+	std::filesystem::path const &path,
+	std::string_view text,
+	size_t chunkCount,
+	unsigned threadCount,
+	MaterialLibraryCache *libraries)
 {
+	std::vector<Chunk> chunks = splitIntoChunks(text, chunkCount);
+	util::parallelFor(chunks.size(), threadCount, [&](size_t i) {
+		chunks[i].counts = countElements(chunks[i].text);
+	});
+
 	// Append a dummy value, because OBJ indexes begin at 1.
-	std::vector<glm::vec3> positions(1);
-	std::vector<glm::vec3> normals(1);
-	std::vector<Mesh> meshes;
-	std::vector<Vertex> meshVertices;
-	MaterialLibrary materials;
-	Material currentMaterial;
+	size_t positionCount = 1;
+	size_t normalCount = 1;
+	for (auto &chunk: chunks) {
+		chunk.positionBase = positionCount;
+		chunk.normalBase = normalCount;
+		positionCount += chunk.counts.positions;
+		normalCount += chunk.counts.normals;
+	}
+	std::vector<glm::vec3> positions(positionCount);
+	std::vector<glm::vec3> normals(normalCount);
 
-	std::ifstream file(path);
-	if (!file.is_open()) {
-		util::fatalError("Could not open OBJ file: ", path);
+	util::parallelFor(chunks.size(), threadCount, [&](size_t i) {
+		parseChunk(chunks[i], positions, normals);
+	});
+	for (auto const &chunk: chunks) {
+		if (chunk.failed) {
+			util::fatalError("Could not parse file: ", path);
+		}
 	}
 
-	while (file.good()) {
-		std::string token;
-		file >> token;
-		if (token == "v") {
-			positions.push_back(readVector3(file));
-		} else if (token == "vn") {
-			normals.push_back(readVector3(file));
-		} else if (token == "f") {
-			// This assumes convex polygons.
-			Vertex first = readVertex(file, positions, normals, currentMaterial);
-			Vertex last = readVertex(file, positions, normals, currentMaterial);
+	// Replay the statements in file order to find out where every run of
+	// corners ends up. This is cheap compared to the rest of the parsing.
+	// Segments of each mesh, and the number of their corners.
+	std::vector<std::vector<Segment>> meshSegments(1);
+	std::vector<size_t> meshSizes(1);
+	std::pmr::monotonic_buffer_resource arena;
+	MaterialState materials(libraries, arena);
+	// See ModelBuilder::smoothingGroup.
+	uint32_t smoothingGroup = 1;
 
-			file >> whitespace;
-			while (file.good() && isNumeric(file.peek())) {
-				Vertex curr = readVertex(file, positions, normals, currentMaterial);
+	auto addSegment = [&](Chunk const &chunk, size_t begin, size_t end) {
+		if (begin < end) {
+			meshSegments.back().push_back({&chunk, begin, end, materials.currentId, smoothingGroup});
+			meshSizes.back() += end - begin;
+		}
+	};
 
-				meshVertices.push_back(first);
-				meshVertices.push_back(last);
-				meshVertices.push_back(curr);
+	for (auto const &chunk: chunks) {
+		size_t begin = 0;
+		for (auto const &event: chunk.events) {
+			addSegment(chunk, begin, event.corner);
+			begin = event.corner;
 
-				last = curr;
-				file >> whitespace;
+			switch (event.type) {
+			case ChunkEvent::NEW_OBJECT:
+				if (meshSizes.back() > 0) {
+					meshSegments.emplace_back();
+					meshSizes.push_back(0);
+				}
+				break;
+			case ChunkEvent::LOAD_LIBRARY:
+				materials.loadLibrary(path.parent_path().append(event.name));
+				break;
+			case ChunkEvent::USE_MATERIAL:
+				materials.use(event.name);
+				break;
+			case ChunkEvent::SMOOTHING_GROUP:
+				smoothingGroup = event.smoothingGroup;
+				break;
 			}
+		}
+		addSegment(chunk, begin, chunk.corners.size());
+	}
+	if (meshSizes.back() == 0) {
+		meshSegments.pop_back();
+	}
+
+	// Normals are generated one mesh at a time with all threads, since most
+	// files without normals are scans that consist of a single large mesh.
+	std::vector<char> missingNormals(meshSegments.size());
+	util::parallelFor(meshSegments.size(), threadCount, [&](size_t i) {
+		for (Segment const &segment: meshSegments[i]) {
+			auto begin = segment.chunk->corners.begin();
+			missingNormals[i] |= std::any_of(begin + segment.begin, begin + segment.end, [](Corner const &corner) {
+				return corner.normal == 0;
+			});
+		}
+	});
+
+	std::vector<MeshData> meshes(meshSegments.size());
+	TriangleList triangles;
+	MeshBuilder builder;
+	for (size_t i = 0; i < meshes.size(); ++i) {
+		if (!missingNormals[i]) {
+			continue;
+		}
+		triangles.clear();
+		triangles.corners.reserve(meshSizes[i]);
+		for (Segment const &segment: meshSegments[i]) {
+			auto begin = segment.chunk->corners.begin();
+			triangles.corners.insert(triangles.corners.end(), begin + segment.begin, begin + segment.end);
+			size_t triangleCount = (segment.end - segment.begin) / 3;
+			triangles.materials.insert(triangles.materials.end(), triangleCount, segment.materialId);
+			triangles.smoothingGroups.insert(triangles.smoothingGroups.end(), triangleCount, segment.smoothingGroup);
+		}
+		meshes[i] = buildMesh(builder, triangles, positions, normals, threadCount);
+	}
+
+	util::parallelFor(meshes.size(), threadCount, [&](size_t i) {
+		if (missingNormals[i]) {
+			return;
+		}
+		MeshBuilder builder(meshSizes[i]);
+		for (Segment const &segment: meshSegments[i]) {
+			for (size_t k = segment.begin; k < segment.end; ++k) {
+				addCorner(builder, segment.chunk->corners[k], positions, normals, segment.materialId);
+			}
+		}
+		meshes[i] = builder.finish();
+	});
+
+	Bounds bounds = getModelBounds(meshes);
+	return {std::move(meshes), std::move(materials.table), std::move(materials.loadedLibraries), bounds};
+}
+
+// Parses text that is in memory as a whole, in chunks if it is large enough.
+static ModelData parseText(
+	std::filesystem::path const &path,
+	std::string_view text,
+	unsigned threadCount,
+	MaterialLibraryCache *libraries)
+{
+	// Chunks smaller than this are not worth the overhead of a thread. More
+	// chunks than threads help to balance uneven parts of the file.
+	constexpr size_t MIN_CHUNK_SIZE = 1 << 20;
+	constexpr size_t CHUNKS_PER_THREAD = 4;
+
+	size_t chunkCount = std::min(text.size() / MIN_CHUNK_SIZE, threadCount * CHUNKS_PER_THREAD);
+	if (threadCount == 1 || chunkCount <= 1) {
+		return parseSerial(path, text, threadCount, libraries);
+	}
+	return parseParallel(path, text, chunkCount, threadCount, libraries);
+}
+
+ModelData parseObjFile(std::filesystem::path const &path, unsigned threadCount, MaterialLibraryCache *libraries)
+{
+	if (threadCount == 0) {
+		threadCount = util::hardwareThreadCount();
+	}
+
+	// Chunks of a compressed file cannot be located without decompressing
+	// everything before them, so these are parsed in a single pass instead.
+	if (isCompressedFile(path)) {
+		return parseCompressed(path, threadCount, libraries);
+	}
+
+	MappedFile file(path);
+	return parseText(path, file.view(), threadCount, libraries);
+}
+
+std::vector<ModelData> parseObjFiles(std::vector<std::filesystem::path> const &paths, unsigned threadCount)
+{
+	if (threadCount == 0) {
+		threadCount = util::hardwareThreadCount();
+	}
+
+	std::vector<uintmax_t> sizes(paths.size());
+	uintmax_t totalSize = 0;
+	for (size_t i = 0; i < paths.size(); ++i) {
+		std::error_code error;
+		sizes[i] = std::filesystem::file_size(paths[i], error);
+		sizes[i] = error ? 0 : sizes[i];
+		totalSize += sizes[i];
+	}
+	// Files are handed out largest first, so that the large ones can take
+	// most of the threads and the small ones fill the gaps at the end.
+	std::vector<size_t> order(paths.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+		return sizes[a] > sizes[b];
+	});
+
+	// Every worker parses one file at a time. A file also gets as many of
+	// the spare threads as its share of the total size calls for, as far as
+	// other files do not use them, so no more than threadCount threads run.
+	auto workerCount = static_cast<unsigned>(std::min<size_t>(threadCount, paths.size()));
+	unsigned spareThreads = threadCount - workerCount;
+	std::mutex spareMutex;
+
+	MaterialLibraryCache libraries;
+	std::vector<ModelData> models(paths.size());
+	util::parallelFor(order.size(), workerCount, [&](size_t k) {
+		size_t i = order[k];
+		double share = totalSize > 0 ? static_cast<double>(sizes[i]) / static_cast<double>(totalSize) : 0.0;
+		auto wanted = static_cast<unsigned>(share * threadCount + 0.5);
+		unsigned extraThreads = 0;
+		{
+			std::lock_guard lock(spareMutex);
+			extraThreads = std::min(spareThreads, std::max(1u, wanted) - 1);
+			spareThreads -= extraThreads;
+		}
+		models[i] = parseObjFile(paths[i], 1 + extraThreads, &libraries);
+		std::lock_guard lock(spareMutex);
+		spareThreads += extraThreads;
+	});
+	return models;
+}
+
+// An object of a file for IncrementalObjParser, with the statements in it that
+// affect the materials and smoothing groups of its faces.
+struct ObjectText {
+	// From the o statement up to the next one. The first object begins at the
+	// start of the file instead.
+	std::string_view text;
+	// Sizes of the position and normal lists before the object, including the
+	// dummy values.
+	size_t positionBase {0};
+	size_t normalBase {0};
+	// Number of corners after triangulation.
+	size_t corners {0};
+	// Only mtllib, usemtl and s statements.
+	std::vector<ChunkEvent> events;
+	// Material and smoothing group at the start of the object, and the
+	// material of every usemtl statement in it. Set by resolveMaterials.
+	uint32_t materialId {0};
+	uint32_t smoothingGroup {1};
+	std::vector<uint32_t> materialIds;
+};
+
+// Splits the text at the o statements, only looking at the first token of each
+// line like countElements does.
+static std::vector<ObjectText> splitIntoObjects(std::string_view text)
+{
+	std::vector<ObjectText> objects(1);
+	objects.back().positionBase = 1;
+	objects.back().normalBase = 1;
+	size_t positionCount = 1;
+	size_t normalCount = 1;
+	size_t begin = 0;
+
+	Tokenizer tokens(text);
+	while (!tokens.atEnd()) {
+		size_t lineBegin = text.size() - tokens.remaining();
+		std::string_view token = tokens.nextToken();
+		ObjectText &object = objects.back();
+		if (token == "v") {
+			++positionCount;
+		} else if (token == "vn") {
+			++normalCount;
+		} else if (token == "f") {
+			object.corners += countTriangleCorners(tokens);
+		} else if (token == "o") {
+			object.text = text.substr(begin, lineBegin - begin);
+			begin = lineBegin;
+			ObjectText next;
+			next.positionBase = positionCount;
+			next.normalBase = normalCount;
+			objects.push_back(std::move(next));
 		} else if (token == "mtllib") {
-			std::string lib;
-			file >> lib;
-			materials = parseMtlLibrary(path.parent_path().append(lib));
+			object.events.push_back({ChunkEvent::LOAD_LIBRARY, object.corners, tokens.nextToken()});
 		} else if (token == "usemtl") {
-			std::string name;
-			file >> name;
-			currentMaterial = materials[name];
-		} else if (token == "o") {
-			if (!meshVertices.empty()) {
-				meshes.emplace_back(meshVertices);
-				meshVertices.clear();
+			object.events.push_back({ChunkEvent::USE_MATERIAL, object.corners, tokens.nextToken()});
+		} else if (token == "s") {
+			object.events.push_back({ChunkEvent::SMOOTHING_GROUP, object.corners, {}, readSmoothingGroup(tokens)});
+		}
+		tokens.skipLine();
+	}
+	objects.back().text = text.substr(begin);
+
+	return objects;
+}
+
+// Replays the statements of all objects in file order, like parseParallel.
+static void resolveMaterials(
+	std::filesystem::path const &path,
+	std::vector<ObjectText> &objects,
+	MaterialState &materials)
+{
+	// See ModelBuilder::smoothingGroup.
+	uint32_t smoothingGroup = 1;
+	for (ObjectText &object: objects) {
+		object.materialId = materials.currentId;
+		object.smoothingGroup = smoothingGroup;
+		for (ChunkEvent const &event: object.events) {
+			switch (event.type) {
+			case ChunkEvent::LOAD_LIBRARY:
+				materials.loadLibrary(path.parent_path().append(event.name));
+				break;
+			case ChunkEvent::USE_MATERIAL:
+				materials.use(event.name);
+				object.materialIds.push_back(materials.currentId);
+				break;
+			case ChunkEvent::SMOOTHING_GROUP:
+				smoothingGroup = event.smoothingGroup;
+				break;
+			case ChunkEvent::NEW_OBJECT:
+				break;
 			}
 		}
-		if (token != "f") {
-			file.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+	}
+}
+
+// Everything outside of the text of an object that its mesh depends on.
+static uint64_t hashContext(ObjectText const &object)
+{
+	std::vector<uint64_t> values {object.positionBase, object.normalBase, object.materialId, object.smoothingGroup};
+	values.insert(values.end(), object.materialIds.begin(), object.materialIds.end());
+	return util::hashBytes({reinterpret_cast<char const *>(values.data()), values.size() * sizeof(uint64_t)});
+}
+
+// Parses a single object without the rest of the file. Face indexes are made
+// relative to the object, which gives the same mesh as a parse of the whole
+// file as long as the object only refers to its own positions and normals.
+class ObjectParser: public ObjVisitor {
+	ObjectText const &object;
+	// Begin with a dummy value, because OBJ indexes begin at 1.
+	std::vector<glm::vec3> positions;
+	std::vector<glm::vec3> normals;
+	TriangleList triangles;
+	uint32_t materialId;
+	uint32_t smoothingGroup;
+	size_t nextMaterial {0};
+	bool selfContained {true};
+public:
+	explicit ObjectParser(ObjectText const &object)
+		: object(object), positions(1), normals(1), materialId(object.materialId),
+		  smoothingGroup(object.smoothingGroup)
+	{
+		triangles.corners.reserve(object.corners);
+		triangles.materials.reserve(object.corners / 3);
+		triangles.smoothingGroups.reserve(object.corners / 3);
+	}
+
+	void onPosition(glm::vec3 const &position)
+	{
+		positions.push_back(position);
+	}
+
+	void onNormal(glm::vec3 const &normal)
+	{
+		normals.push_back(normal);
+	}
+
+	void onFace(Corner const *corners, size_t count)
+	{
+		for (size_t i = 0; i < count; ++i) {
+			selfContained = selfContained && corners[i].position >= object.positionBase &&
+			                (corners[i].normal == 0 || corners[i].normal >= object.normalBase);
+		}
+		triangulate(corners, count, [&](Corner a, Corner b, Corner c) {
+			triangles.corners.insert(triangles.corners.end(), {toLocal(a), toLocal(b), toLocal(c)});
+			triangles.materials.push_back(materialId);
+			triangles.smoothingGroups.push_back(smoothingGroup);
+		});
+	}
+
+	void onMaterial(std::string_view)
+	{
+		if (nextMaterial < object.materialIds.size()) {
+			materialId = object.materialIds[nextMaterial++];
 		}
-		file >> whitespace;
 	}
-	if (!meshVertices.empty()) {
-		meshes.emplace_back(meshVertices);
+
+	void onSmoothingGroup(uint32_t group)
+	{
+		smoothingGroup = group;
+	}
+
+	[[nodiscard]] bool isSelfContained() const noexcept
+	{
+		return selfContained;
+	}
+
+	// Must only be called if the object is self-contained.
+	MeshData finish(unsigned threadCount)
+	{
+		MeshBuilder builder;
+		return buildMesh(builder, triangles, positions, normals, threadCount);
+	}
+
+private:
+	[[nodiscard]] Corner toLocal(Corner corner) const noexcept
+	{
+		corner.position = corner.position - object.positionBase + 1;
+		corner.normal = corner.normal == 0 ? 0 : corner.normal - object.normalBase + 1;
+		return corner;
+	}
+};
+
+IncrementalObjParser::Result IncrementalObjParser::parse(unsigned threadCount)
+{
+	return read(threadCount, true);
+}
+
+std::vector<Material> IncrementalObjParser::scan(unsigned threadCount)
+{
+	return read(threadCount, false).materials;
+}
+
+// Without building meshes, the faces are only read to find out which objects
+// are self-contained.
+IncrementalObjParser::Result IncrementalObjParser::read(unsigned threadCount, bool buildMeshes)
+{
+	if (threadCount == 0) {
+		threadCount = util::hardwareThreadCount();
 	}
 
-	if (file.fail()) {
+	// Objects are located by their text, so compressed files are decompressed
+	// into memory as a whole.
+	std::optional<MappedFile> file;
+	std::string decompressed;
+	std::string_view text;
+	if (isCompressedFile(path)) {
+		decompressed = readDecompressedFile(path);
+		text = decompressed;
+	} else {
+		text = file.emplace(path).view();
+	}
+
+	std::vector<ObjectText> texts = splitIntoObjects(text);
+	std::pmr::monotonic_buffer_resource arena;
+	MaterialState materials(nullptr, arena);
+	resolveMaterials(path, texts, materials);
+	texts.erase(std::remove_if(texts.begin(), texts.end(), [](ObjectText const &object) {
+		return object.corners == 0;
+	}), texts.end());
+
+	// Every previous mesh can only be taken over once.
+	std::map<std::pair<uint64_t, uint64_t>, size_t> previous;
+	for (size_t i = 0; i < objects.size(); ++i) {
+		if (objects[i].reusable) {
+			previous.emplace(std::pair(objects[i].textHash, objects[i].contextHash), i);
+		}
+	}
+
+	Result result;
+	result.meshes.resize(texts.size());
+	std::vector<Object> newObjects(texts.size());
+	std::vector<size_t> changed;
+	for (size_t i = 0; i < texts.size(); ++i) {
+		Object &object = newObjects[i];
+		object.textHash = util::hashBytes(texts[i].text);
+		object.contextHash = hashContext(texts[i]);
+		object.reusable = true;
+		auto it = previous.find({object.textHash, object.contextHash});
+		if (it != previous.end()) {
+			result.meshes[i].previous = it->second;
+			previous.erase(it);
+		} else {
+			changed.push_back(i);
+		}
+	}
+
+	std::vector<char> failed(changed.size());
+	std::vector<char> selfContained(changed.size());
+	auto meshThreads = static_cast<unsigned>(std::max<size_t>(1, threadCount / std::max<size_t>(1, changed.size())));
+	util::parallelFor(changed.size(), threadCount, [&](size_t k) {
+		ObjectText const &object = texts[changed[k]];
+		ObjectParser parser(object);
+		ObjReader reader(object.positionBase, object.normalBase);
+		reader.read(object.text, parser);
+		failed[k] = reader.fail();
+		selfContained[k] = parser.isSelfContained();
+		if (!failed[k] && selfContained[k] && buildMeshes) {
+			result.meshes[changed[k]].data = parser.finish(meshThreads);
+		}
+	});
+	if (std::find(failed.begin(), failed.end(), true) != failed.end()) {
 		util::fatalError("Could not parse file: ", path);
 	}
 
-	return meshes;
+	// Objects that share positions or normals are parsed together, and are
+	// not reused later.
+	if (std::find(selfContained.begin(), selfContained.end(), false) != selfContained.end()) {
+		if (buildMeshes) {
+			ModelData model = parseText(path, text, threadCount, nullptr);
+			result.meshes.clear();
+			for (MeshData &mesh: model.meshes) {
+				result.meshes.push_back({std::nullopt, std::move(mesh)});
+			}
+			newObjects.resize(result.meshes.size());
+		}
+		for (Object &object: newObjects) {
+			object.reusable = false;
+		}
+	}
+
+	objects = std::move(newObjects);
+	libraries = std::move(materials.loadedLibraries);
+	materialSources.clear();
+	for (auto const &[library, name]: materials.sources) {
+		materialSources.emplace_back(library, std::string(name));
+	}
+	result.materials = std::move(materials.table);
+	return result;
+}
+
+std::vector<Material> IncrementalObjParser::reloadMaterials() const
+{
+	std::vector<std::unique_ptr<MaterialLibrary>> loaded;
+	for (auto const &library: libraries) {
+		loaded.push_back(parseMtlLibrary(library));
+	}
+
+	std::vector<Material> table;
+	table.reserve(materialSources.size());
+	for (auto const &[library, name]: materialSources) {
+		Material const *material = library < loaded.size() ? loaded[library]->find(name) : nullptr;
+		table.push_back(material ? *material : Material {});
+	}
+	return table;
+}
+
+Model loadModelFromFile(std::filesystem::path const &path, unsigned threadCount)
+{
+	if (isGlbFile(path)) {
+		return loadGlbFile(path);
+	}
+
+	std::filesystem::path cachePath = getMeshCachePath(path);
+	if (auto cached = loadMeshCache(cachePath, path)) {
+		return std::move(*cached);
+	}
+
+	std::optional<FileStamp> stamp = getFileStamp(path);
+	ModelData data = parseObjFile(path, threadCount);
+	std::vector<MeshInstances> instances = optimizeMeshes(data.meshes, threadCount);
+	PackedModel packed = packModel(data, instances, threadCount);
+	packed.source = stamp;
+	writeMeshCache(cachePath, path, packed);
+	return createModel(packed);
 }
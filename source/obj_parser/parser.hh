@@ -1,9 +1,125 @@
 #pragma once
 
+#include <string>
 #include <vector>
+#include <cstdint>
+#include <utility>
+#include <optional>
 #include <filesystem>
-#include "mesh.hh"
+#include "model.hh"
+#include "obj_parser/mesh_data.hh"
 
-// Very basic Wavefront OBJ format parser. File content is not validated during
-// parsing.
-std::vector<Mesh> loadMeshesFromFile(std::filesystem::path const &);
+// Very basic Wavefront OBJ format parser, built on the streaming ObjReader
+// from obj_parser/reader.hh. File content is not validated during
+// parsing, apart from the syntax of numbers and the range of face indexes.
+// Face corners with the same position, normal and material share a vertex.
+//
+// Corners without a normal get a generated one, see generateNormals. Faces are
+// smoothed according to their s statements, with a crease angle of 60
+// degrees. Faces before the first s statement are smoothed as well.
+//
+// Large files are split into chunks at line boundaries which are parsed on
+// threadCount threads (0 means one per hardware thread). The result is the same
+// for every thread count.
+//
+// Files ending in .gz or .zst are decompressed on a separate thread while the
+// decompressed text is parsed, and so are material libraries. These are always
+// parsed in a single pass.
+//
+// Material libraries are read from the cache if one is given, see
+// MaterialLibraryCache.
+ModelData parseObjFile(
+	std::filesystem::path const &,
+	unsigned threadCount = 0,
+	MaterialLibraryCache *libraries = nullptr);
+
+// Parses the files on threadCount threads (0 means one per hardware thread),
+// and returns them in the same order. Material libraries that several files
+// use are only parsed once. Up to threadCount files are parsed at a time,
+// largest first, and each one gets a share of the threads that are not busy
+// with other files according to its size.
+std::vector<ModelData> parseObjFiles(std::vector<std::filesystem::path> const &, unsigned threadCount = 0);
+
+// Parses a file again after it has changed, and only builds the meshes of the
+// objects (the text from one o statement to the next) that have changed since
+// the previous call. An object is kept if its text, the number of positions
+// and normals before it and the materials that it uses are the same as before.
+// The first call builds every mesh.
+//
+// Objects are parsed on their own, so this only works if their faces refer to
+// their own positions and normals. Other files are always parsed completely.
+class IncrementalObjParser {
+public:
+	struct ReloadedMesh {
+		// Index of the mesh in the previous result, if it is unchanged.
+		std::optional<size_t> previous;
+		// Only set for new meshes.
+		MeshData data;
+	};
+
+	struct Result {
+		// In the same order as the meshes of parseObjFile.
+		std::vector<ReloadedMesh> meshes;
+		std::vector<Material> materials;
+	};
+
+private:
+	// An object with faces, which becomes a mesh.
+	struct Object {
+		uint64_t textHash {0};
+		// Hash of the positions of the object in the lists and of the
+		// materials that it uses.
+		uint64_t contextHash {0};
+		// False if the object uses positions or normals of other objects, or
+		// if it has not been parsed on its own.
+		bool reusable {false};
+	};
+
+	std::filesystem::path path;
+	std::vector<Object> objects;
+	std::vector<std::filesystem::path> libraries;
+	// Index in libraries and name of every entry of the material table.
+	std::vector<std::pair<size_t, std::string>> materialSources;
+public:
+	explicit IncrementalObjParser(std::filesystem::path path)
+		: path(std::move(path))
+	{
+	}
+
+	// Throws if the file cannot be parsed, and keeps the previous state then.
+	// The meshes of the previous result are the ones that the indexes refer
+	// to, so every result has to be used.
+	Result parse(unsigned threadCount = 0);
+
+	// Takes the objects of the file as the previous result without building
+	// their meshes, for a file whose meshes parseObjFile has built already.
+	// Returns the material table. Throws like parse().
+	std::vector<Material> scan(unsigned threadCount = 0);
+
+	// Reads the material libraries again and returns the material table of the
+	// last parse with the new colors, without reading the file itself.
+	[[nodiscard]] std::vector<Material> reloadMaterials() const;
+
+	// Material libraries that the file used when it was parsed last.
+	[[nodiscard]] std::vector<std::filesystem::path> const &getLibraries() const noexcept
+	{
+		return libraries;
+	}
+
+	[[nodiscard]] std::filesystem::path const &getPath() const noexcept
+	{
+		return path;
+	}
+
+private:
+	Result read(unsigned threadCount, bool buildMeshes);
+};
+
+// Parses the file and uploads every object and the material table to the GPU.
+// The parsed model is kept in a binary cache next to the file, which is used
+// instead of parsing as long as neither the file nor its material libraries
+// have changed. The meshes are optimized for the vertex cache and for overdraw
+// before they are cached, see optimizeMesh.
+//
+// Files ending in .glb are read with loadGlbFile instead, without a cache.
+Model loadModelFromFile(std::filesystem::path const &, unsigned threadCount = 0);
@@ -0,0 +1,268 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <istream>
+#include <algorithm>
+#include <filesystem>
+#include <string_view>
+#include <glm/vec3.hpp>
+#include "obj_parser/tokenizer.hh"
+#include "obj_parser/numbers.hh"
+#include "obj_parser/mapped_file.hh"
+#include "util.hh"
+
+inline float readFloat(Tokenizer &tokens)
+{
+	float f = 0.0f;
+	if (!parseFloat(tokens.nextToken(), f)) {
+		tokens.setFail();
+	}
+	return f;
+}
+
+inline glm::vec3 readVector3(Tokenizer &tokens)
+{
+	glm::vec3 v;
+	v.x = readFloat(tokens);
+	v.y = readFloat(tokens);
+	v.z = readFloat(tokens);
+	return v;
+}
+
+// Smoothing groups are numbers, or "off", which is the same as zero.
+inline uint32_t readSmoothingGroup(Tokenizer &tokens)
+{
+	std::string_view token = tokens.nextToken();
+	long group = 0;
+	if (token != "off" && (!parseIndex(token, group) || group < 0 || group > UINT32_MAX)) {
+		tokens.setFail();
+	}
+	return static_cast<uint32_t>(group);
+}
+
+// Whether c may begin a face corner.
+inline bool isNumeric(int c)
+{
+	return (c >= '0' && c <= '9') || c == '-';
+}
+
+// Position and normal indexes of a single face corner. OBJ indexes begin at 1,
+// so zero refers to a dummy element. Corners without a normal use it as well.
+struct Corner {
+	size_t position {0};
+	size_t normal {0};
+};
+
+// Base class for the consumers of ObjReader. Derived classes hide the
+// functions they are interested in. They are called without virtual dispatch,
+// so the others cost nothing.
+struct ObjVisitor {
+	void onPosition(glm::vec3 const &) {}
+	void onNormal(glm::vec3 const &) {}
+	// Receives all corners of a face in order. Negative indexes have already
+	// been resolved, and all indexes are in range.
+	void onFace(Corner const *, size_t) {}
+	void onObject(std::string_view) {}
+	void onMaterialLibrary(std::string_view) {}
+	void onMaterial(std::string_view) {}
+	// Faces in group zero are flat shaded.
+	void onSmoothingGroup(uint32_t) {}
+};
+
+// Splits a face into a triangle fan, which assumes convex polygons.
+template<typename EmitTriangle>
+void triangulate(Corner const *corners, size_t count, EmitTriangle const &emitTriangle)
+{
+	for (size_t i = 2; i < count; ++i) {
+		emitTriangle(corners[0], corners[i - 1], corners[i]);
+	}
+}
+
+// Streaming parser for Wavefront OBJ files. Every statement is passed to a
+// visitor as soon as it has been read. Apart from the corners of the current
+// face, the reader only remembers how many positions and normals it has seen,
+// which is needed to resolve negative indexes. The text may be passed in
+// several pieces.
+class ObjReader {
+	size_t positionCount;
+	size_t normalCount;
+	std::vector<Corner> face;
+	bool failed {false};
+public:
+	// The counts are the sizes of the position and normal lists, including
+	// the dummy values, before the first line that is passed to read().
+	explicit ObjReader(size_t positionCount = 1, size_t normalCount = 1)
+		: positionCount(positionCount), normalCount(normalCount)
+	{
+	}
+
+	[[nodiscard]] bool fail() const noexcept
+	{
+		return failed;
+	}
+
+	// Reads all complete lines of text and returns the number of bytes that
+	// were consumed. If isLast is true, the final line does not need to end
+	// with a line break. Stops at the first malformed statement.
+	template<typename Visitor>
+	size_t read(std::string_view text, Visitor &visitor, bool isLast = true)
+	{
+		if (!isLast) {
+			text = text.substr(0, text.rfind('\n') + 1);
+		}
+
+		Tokenizer tokens(text);
+		while (!tokens.atEnd() && !tokens.fail()) {
+			std::string_view token = tokens.nextToken();
+			if (token == "v") {
+				glm::vec3 position = readVector3(tokens);
+				if (!tokens.fail()) {
+					++positionCount;
+					visitor.onPosition(position);
+				}
+			} else if (token == "vn") {
+				glm::vec3 normal = readVector3(tokens);
+				if (!tokens.fail()) {
+					++normalCount;
+					visitor.onNormal(normal);
+				}
+			} else if (token == "f") {
+				readFace(tokens);
+				if (!tokens.fail()) {
+					visitor.onFace(face.data(), face.size());
+				}
+			} else if (token == "mtllib") {
+				visitor.onMaterialLibrary(tokens.nextToken());
+			} else if (token == "usemtl") {
+				visitor.onMaterial(tokens.nextToken());
+			} else if (token == "o") {
+				visitor.onObject(tokens.nextToken());
+			} else if (token == "s") {
+				uint32_t group = readSmoothingGroup(tokens);
+				if (!tokens.fail()) {
+					visitor.onSmoothingGroup(group);
+				}
+			}
+			tokens.skipLine();
+		}
+
+		failed = failed || tokens.fail();
+		return text.size() - tokens.remaining();
+	}
+
+private:
+	Corner readCorner(Tokenizer &tokens) const
+	{
+		// Face corners have the form v, v/vt, v//vn or v/vt/vn. The numbers
+		// are parsed in place, so the separators never need a separate scan.
+		std::string_view corner = tokens.nextToken();
+		char const *p = corner.data();
+		char const *end = p + corner.size();
+		long indices[3] {0, 0, 0};
+		for (int i = 0; i < 3; ++i) {
+			if (i == 0 || (p != end && *p != '/')) {
+				p = parseIndexPrefix(p, end, indices[i]);
+				if (!p || (p != end && *p != '/')) {
+					tokens.setFail();
+					return {};
+				}
+			}
+			if (p != end) {
+				++p;
+			}
+		}
+		// Negative indexes are relative to the end of the current list.
+		if (indices[0] < 0) {
+			indices[0] += static_cast<long>(positionCount);
+		}
+		if (indices[2] < 0) {
+			indices[2] += static_cast<long>(normalCount);
+		}
+		if (indices[0] < 0 || indices[0] >= static_cast<long>(positionCount) ||
+		    indices[2] < 0 || indices[2] >= static_cast<long>(normalCount)) {
+			tokens.setFail();
+			return {};
+		}
+		return {static_cast<size_t>(indices[0]), static_cast<size_t>(indices[2])};
+	}
+
+	void readFace(Tokenizer &tokens)
+	{
+		face.clear();
+		face.push_back(readCorner(tokens));
+		face.push_back(readCorner(tokens));
+
+		tokens.skipBlanks();
+		while (!tokens.fail() && isNumeric(tokens.peek())) {
+			face.push_back(readCorner(tokens));
+			tokens.skipBlanks();
+		}
+	}
+};
+
+// Reads a whole file with ObjReader. Throws if the file cannot be opened or
+// contains malformed statements.
+template<typename Visitor>
+void readObjFile(std::filesystem::path const &path, Visitor &visitor)
+{
+	MappedFile file(path);
+	ObjReader reader;
+	reader.read(file.view(), visitor);
+	if (reader.fail()) {
+		util::fatalError("Could not parse file: ", path);
+	}
+}
+
+// Reads OBJ text that arrives in blocks of any size, for example from a
+// decompressor. next() returns the next block, or an empty view at the end.
+// The previous block may be overwritten by the call. Blocks are parsed in
+// place, only lines that are split between two blocks are copied. Returns
+// false if the text is malformed.
+template<typename NextBlock, typename Visitor>
+bool readObjBlocks(NextBlock const &next, Visitor &visitor)
+{
+	ObjReader reader;
+	// The beginning of a line that continues in the next block.
+	std::string line;
+
+	for (std::string_view block = next(); !block.empty(); block = next()) {
+		if (!line.empty()) {
+			size_t newline = block.find('\n');
+			if (newline == std::string_view::npos) {
+				line += block;
+				continue;
+			}
+			line += block.substr(0, newline + 1);
+			reader.read(line, visitor, false);
+			block.remove_prefix(newline + 1);
+		}
+		size_t consumed = reader.read(block, visitor, false);
+		line.assign(block.substr(consumed));
+		if (reader.fail()) {
+			return false;
+		}
+	}
+
+	reader.read(line, visitor);
+	return !reader.fail();
+}
+
+// Reads OBJ text from a stream in fixed-size blocks, so memory use does not
+// depend on the size of the input.
+template<typename Visitor>
+void readObjStream(std::istream &in, Visitor &visitor)
+{
+	constexpr size_t BLOCK_SIZE = 1 << 16;
+	std::vector<char> buffer(BLOCK_SIZE);
+
+	bool success = readObjBlocks([&] {
+		in.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+		return std::string_view(buffer.data(), static_cast<size_t>(in.gcount()));
+	}, visitor);
+
+	if (!success || in.bad()) {
+		util::fatalError("Could not parse OBJ stream");
+	}
+}
@@ -0,0 +1,181 @@
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include "smooth_normals.hh"
+#include "parallel.hh"
+
+// Hands out items in blocks, since a single triangle is far too little work
+// to be worth an atomic increment.
+template<typename Function>
+static void parallelForItems(size_t count, unsigned threadCount, Function const &function)
+{
+	constexpr size_t BLOCK_SIZE = 1 << 12;
+	size_t blockCount = (count + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	util::parallelFor(blockCount, threadCount, [&](size_t block) {
+		size_t end = std::min(count, (block + 1) * BLOCK_SIZE);
+		for (size_t i = block * BLOCK_SIZE; i < end; ++i) {
+			function(i);
+		}
+	});
+}
+
+void generateNormals(
+	TriangleList &triangles,
+	std::vector<glm::vec3> const &positions,
+	std::vector<glm::vec3> &normals,
+	float creaseAngle,
+	unsigned threadCount)
+{
+	std::vector<Corner> &corners = triangles.corners;
+	std::vector<uint32_t> const &groups = triangles.smoothingGroups;
+	size_t triangleCount = corners.size() / 3;
+	if (std::none_of(corners.begin(), corners.end(), [](Corner const &corner) { return corner.normal == 0; })) {
+		return;
+	}
+
+	// The length of the cross product is twice the area of the triangle, so
+	// scaling it by the angle at a corner gives both weights at once.
+	std::vector<glm::vec3> faceNormals(triangleCount);
+	std::vector<glm::vec3> weightedNormals(corners.size());
+	parallelForItems(triangleCount, threadCount, [&](size_t t) {
+		glm::vec3 p[3];
+		for (size_t k = 0; k < 3; ++k) {
+			p[k] = positions[corners[3 * t + k].position];
+		}
+		glm::vec3 cross = glm::cross(p[1] - p[0], p[2] - p[0]);
+		float doubleArea = glm::length(cross);
+		faceNormals[t] = doubleArea > 0.0f ? cross / doubleArea : glm::vec3(0.0f);
+		for (size_t k = 0; k < 3; ++k) {
+			glm::vec3 a = p[(k + 1) % 3] - p[k];
+			glm::vec3 b = p[(k + 2) % 3] - p[k];
+			// Stable for thin triangles, unlike the arc cosine.
+			float angle = std::atan2(doubleArea, glm::dot(a, b));
+			weightedNormals[3 * t + k] = cross * angle;
+		}
+	});
+
+	// Corners grouped by position, in the same order as in the mesh. Meshes
+	// usually refer to a compact range of positions, so a counting sort over
+	// that range is enough.
+	size_t first = corners[0].position;
+	size_t last = corners[0].position;
+	for (Corner const &corner: corners) {
+		first = std::min(first, corner.position);
+		last = std::max(last, corner.position);
+	}
+	std::vector<uint32_t> offsets(last - first + 2, 0);
+	for (Corner const &corner: corners) {
+		++offsets[corner.position - first + 1];
+	}
+	for (size_t i = 1; i < offsets.size(); ++i) {
+		offsets[i] += offsets[i - 1];
+	}
+	std::vector<uint32_t> adjacent(corners.size());
+	{
+		std::vector<uint32_t> next(offsets.begin(), offsets.end() - 1);
+		for (size_t i = 0; i < corners.size(); ++i) {
+			adjacent[next[corners[i].position - first]++] = static_cast<uint32_t>(i);
+		}
+	}
+
+	// The triangles of a smoothing group around a position form crease
+	// clusters: a triangle joins the first cluster whose first triangle is
+	// within the crease angle of its own, and starts a new cluster otherwise.
+	// Every corner of a cluster gets the same normal, so each sum is only
+	// computed once per cluster rather than once per corner. The positions are
+	// independent, and the order of the additions is fixed.
+	float minCosine = std::cos(creaseAngle);
+	std::vector<glm::vec3> results(corners.size());
+	std::vector<char> missing(corners.size());
+	std::vector<glm::vec3> sums(corners.size());
+	// The first corner of the cluster of every corner, and later the first
+	// corner at the same position with the same result.
+	std::vector<uint32_t> representatives(corners.size());
+	// Per position, first the clusters and then the corners sorted by result.
+	std::vector<uint32_t> scratch(corners.size());
+	parallelForItems(offsets.size() - 1, threadCount, [&](size_t slot) {
+		uint32_t begin = offsets[slot];
+		uint32_t end = offsets[slot + 1];
+		auto clusters = scratch.begin() + begin;
+		auto clustersEnd = clusters;
+		for (uint32_t k = begin; k < end; ++k) {
+			uint32_t i = adjacent[k];
+			size_t t = i / 3;
+			representatives[i] = i;
+			if (groups[t] == 0 || glm::dot(faceNormals[t], faceNormals[t]) == 0.0f) {
+				continue;
+			}
+			auto cluster = std::find_if(clusters, clustersEnd, [&](uint32_t first) {
+				size_t other = first / 3;
+				return groups[other] == groups[t] && glm::dot(faceNormals[t], faceNormals[other]) >= minCosine;
+			});
+			if (cluster == clustersEnd) {
+				*clustersEnd++ = i;
+			} else {
+				representatives[i] = *cluster;
+			}
+			sums[representatives[i]] += weightedNormals[i];
+		}
+
+		for (uint32_t k = begin; k < end; ++k) {
+			uint32_t i = adjacent[k];
+			size_t t = i / 3;
+			missing[i] = corners[i].normal == 0;
+			results[i] = faceNormals[t];
+			if (!missing[i] || groups[t] == 0) {
+				continue;
+			}
+			glm::vec3 sum = sums[representatives[i]];
+			// Degenerate triangles have no normal to compare with. They take
+			// the average of the whole group instead, so that they do not
+			// split vertices.
+			if (glm::dot(faceNormals[t], faceNormals[t]) == 0.0f) {
+				for (uint32_t n = begin; n < end; ++n) {
+					if (groups[adjacent[n] / 3] == groups[t]) {
+						sum += weightedNormals[adjacent[n]];
+					}
+				}
+			}
+			float length = glm::length(sum);
+			if (length > 0.0f) {
+				results[i] = sum / length;
+			}
+		}
+
+		// Corners at the same position usually end up with the same normal,
+		// unless they are on different sides of a crease. Sorting them by
+		// their result finds the first corner with each one.
+		auto sorted = scratch.begin() + begin;
+		auto sortedEnd = sorted;
+		for (uint32_t k = begin; k < end; ++k) {
+			if (missing[adjacent[k]]) {
+				*sortedEnd++ = k;
+			}
+		}
+		std::sort(sorted, sortedEnd, [&](uint32_t a, uint32_t b) {
+			int order = std::memcmp(&results[adjacent[a]], &results[adjacent[b]], sizeof(glm::vec3));
+			return order != 0 ? order < 0 : a < b;
+		});
+		for (auto k = sorted; k != sortedEnd; ++k) {
+			uint32_t i = adjacent[*k];
+			uint32_t previous = k != sorted ? adjacent[*(k - 1)] : i;
+			bool same = previous != i && std::memcmp(&results[i], &results[previous], sizeof(glm::vec3)) == 0;
+			representatives[i] = same ? representatives[previous] : i;
+		}
+	});
+
+	// The first corner with each result comes first in the order of the
+	// positions, so the other ones can take its normal.
+	for (uint32_t i: adjacent) {
+		if (!missing[i]) {
+			continue;
+		}
+		if (representatives[i] == i) {
+			corners[i].normal = normals.size();
+			normals.push_back(results[i]);
+		} else {
+			corners[i].normal = corners[representatives[i]].normal;
+		}
+	}
+}
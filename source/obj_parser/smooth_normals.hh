@@ -0,0 +1,47 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <glm/vec3.hpp>
+#include "obj_parser/reader.hh"
+
+// Triangles of a single mesh. The corners refer to the position and normal
+// lists of the whole model.
+struct TriangleList {
+	// Three consecutive corners form a triangle.
+	std::vector<Corner> corners;
+	// Material and smoothing group of every triangle.
+	std::vector<uint32_t> materials;
+	std::vector<uint32_t> smoothingGroups;
+
+	[[nodiscard]] bool empty() const noexcept
+	{
+		return corners.empty();
+	}
+
+	void clear() noexcept
+	{
+		corners.clear();
+		materials.clear();
+		smoothingGroups.clear();
+	}
+};
+
+// Generates normals for all corners that do not have one and appends them to
+// normals. A corner of a triangle in smoothing group zero gets the normal of
+// the triangle. Otherwise, the triangles around the position in the same group
+// are split into crease clusters: each triangle joins the first cluster whose
+// first triangle has a normal within creaseAngle (in radians) of its own, so
+// that hard edges stay hard. The normals of the triangles of a cluster are
+// averaged, weighted by their area and their angle at the corner. Corners at
+// the same position with the same result share a normal. Does nothing if every
+// corner has a normal already.
+//
+// The work is split between threadCount threads. Every sum is computed in the
+// same order, so the result does not depend on the number of threads.
+void generateNormals(
+	TriangleList &triangles,
+	std::vector<glm::vec3> const &positions,
+	std::vector<glm::vec3> &normals,
+	float creaseAngle,
+	unsigned threadCount);
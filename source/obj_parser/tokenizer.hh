@@ -0,0 +1,199 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <string_view>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// Splits a text buffer into whitespace separated tokens, line by line. The
+// returned tokens are views into the original buffer, so nothing is copied
+// and they stay valid for as long as the buffer does.
+//
+// Instead of looking at one byte at a time, the tokenizer classifies blocks of
+// 64 bytes at once into bit masks of blanks and line breaks, similar to the
+// structural index of simdjson. Token and line boundaries are then found with
+// a single count-trailing-zeros on the cached masks. Blocks are classified
+// with AVX2 or SSE2 if the compiler targets them, and byte by byte otherwise.
+class Tokenizer {
+	static constexpr size_t BLOCK_SIZE = 64;
+
+	char const *begin;
+	char const *cursor;
+	char const *end;
+	bool failed {false};
+	// Bit i of the masks refers to blockStart[i]. Blocks never reach past the
+	// end of the text. The last one is moved back instead, so that it ends
+	// exactly there. Only texts shorter than a block have unused bits.
+	char const *blockStart;
+	uint64_t blanks {0};
+	uint64_t newlines {0};
+	uint64_t delimiters {0};
+public:
+	explicit Tokenizer(std::string_view text) noexcept
+		: begin(text.data()), cursor(begin), end(begin + text.size()), blockStart(begin)
+	{
+		classifyBlock(cursor);
+	}
+
+	[[nodiscard]] bool atEnd() const noexcept
+	{
+		return cursor == end;
+	}
+
+	// Number of bytes that have not been consumed yet.
+	[[nodiscard]] size_t remaining() const noexcept
+	{
+		return static_cast<size_t>(end - cursor);
+	}
+
+	// Similar to std::istream::fail(). Set by the parsing functions if
+	// they encounter malformed input.
+	[[nodiscard]] bool fail() const noexcept
+	{
+		return failed;
+	}
+
+	void setFail() noexcept
+	{
+		failed = true;
+	}
+
+	// Returns the next character on the current line without consuming it,
+	// or -1 at the end of the line.
+	[[nodiscard]] int peek() const noexcept
+	{
+		if (cursor == end || *cursor == '\n') {
+			return -1;
+		}
+		return static_cast<unsigned char>(*cursor);
+	}
+
+	// Skips spaces and tabs, but never moves past the end of the current line.
+	void skipBlanks() noexcept
+	{
+		cursor = findFirst(cursor, [this] { return ~blanks; });
+	}
+
+	// Returns the next token on the current line, or an empty view if there
+	// is none left.
+	std::string_view nextToken() noexcept
+	{
+		skipBlanks();
+		char const *start = cursor;
+		cursor = findFirst(cursor, [this] { return delimiters; });
+		return {start, static_cast<size_t>(cursor - start)};
+	}
+
+	// Moves the cursor to the beginning of the next line.
+	void skipLine() noexcept
+	{
+		char const *newline = findFirst(cursor, [this] { return newlines; });
+		cursor = newline == end ? end : newline + 1;
+	}
+
+private:
+	static bool isBlank(char c) noexcept
+	{
+		// Carriage returns are treated as blanks to support CRLF line endings.
+		return c == ' ' || c == '\t' || c == '\r';
+	}
+
+	// Returns the first byte at or after p whose bit is set in the mask that
+	// select() returns for the current block, or end if there is none. Most
+	// searches end in the current block, so only that case is inlined.
+	template<typename Select>
+	char const *findFirst(char const *p, Select const &select) noexcept
+	{
+		auto offset = static_cast<size_t>(p - blockStart);
+		if (offset < BLOCK_SIZE) {
+			uint64_t bits = select() >> offset;
+			if (bits != 0) {
+				return p + __builtin_ctzll(bits);
+			}
+		}
+		return findFirstInNextBlocks(p, select);
+	}
+
+	template<typename Select>
+	[[gnu::noinline]] char const *findFirstInNextBlocks(char const *p, Select const &select) noexcept
+	{
+		auto offset = static_cast<size_t>(p - blockStart);
+		p = offset < BLOCK_SIZE ? blockStart + BLOCK_SIZE : p;
+		while (p < end) {
+			classifyBlock(p);
+			uint64_t bits = select() >> (p - blockStart);
+			if (bits != 0) {
+				return p + __builtin_ctzll(bits);
+			}
+			p = blockStart + BLOCK_SIZE;
+		}
+		return end;
+	}
+
+	// Classifies the block that contains p.
+	void classifyBlock(char const *p) noexcept
+	{
+		blockStart = p;
+		if (static_cast<size_t>(end - p) < BLOCK_SIZE) {
+			blockStart = end - std::min<size_t>(BLOCK_SIZE, end - begin);
+		}
+		auto size = static_cast<size_t>(end - blockStart);
+		if (size < BLOCK_SIZE) {
+			classifyBytes(blockStart, size);
+		} else {
+			classifyFullBlock(blockStart);
+		}
+		delimiters = blanks | newlines;
+	}
+
+	void classifyFullBlock(char const *p) noexcept
+	{
+#if defined(__AVX2__)
+		auto const space = _mm256_set1_epi8(' ');
+		auto const tab = _mm256_set1_epi8('\t');
+		auto const carriageReturn = _mm256_set1_epi8('\r');
+		auto const lineFeed = _mm256_set1_epi8('\n');
+		blanks = 0;
+		newlines = 0;
+		for (size_t i = 0; i < BLOCK_SIZE; i += 32) {
+			auto bytes = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(p + i));
+			auto blank = _mm256_or_si256(
+				_mm256_or_si256(_mm256_cmpeq_epi8(bytes, space), _mm256_cmpeq_epi8(bytes, tab)),
+				_mm256_cmpeq_epi8(bytes, carriageReturn));
+			auto newline = _mm256_cmpeq_epi8(bytes, lineFeed);
+			blanks |= uint64_t(uint32_t(_mm256_movemask_epi8(blank))) << i;
+			newlines |= uint64_t(uint32_t(_mm256_movemask_epi8(newline))) << i;
+		}
+#elif defined(__SSE2__)
+		auto const space = _mm_set1_epi8(' ');
+		auto const tab = _mm_set1_epi8('\t');
+		auto const carriageReturn = _mm_set1_epi8('\r');
+		auto const lineFeed = _mm_set1_epi8('\n');
+		blanks = 0;
+		newlines = 0;
+		for (size_t i = 0; i < BLOCK_SIZE; i += 16) {
+			auto bytes = _mm_loadu_si128(reinterpret_cast<__m128i const *>(p + i));
+			auto blank = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(bytes, space), _mm_cmpeq_epi8(bytes, tab)),
+			                          _mm_cmpeq_epi8(bytes, carriageReturn));
+			auto newline = _mm_cmpeq_epi8(bytes, lineFeed);
+			blanks |= uint64_t(uint16_t(_mm_movemask_epi8(blank))) << i;
+			newlines |= uint64_t(uint16_t(_mm_movemask_epi8(newline))) << i;
+		}
+#else
+		classifyBytes(p, BLOCK_SIZE);
+#endif
+	}
+
+	// Byte by byte version for short texts and other architectures.
+	void classifyBytes(char const *p, size_t size) noexcept
+	{
+		blanks = 0;
+		newlines = 0;
+		for (size_t i = 0; i < size; ++i) {
+			blanks |= uint64_t(isBlank(p[i])) << i;
+			newlines |= uint64_t(p[i] == '\n') << i;
+		}
+	}
+};
@@ -1,11 +1,12 @@
 #pragma once
 
+#include <cstdint>
 #include <glm/vec3.hpp>
 
 struct Vertex {
 	glm::vec3 pos;
 	glm::vec3 normal;
-	// Storing color for each vertex is not very memory efficient, but it
-	// works for this simple application.
-	glm::vec3 color;
+	// Index into the material table of the model. Colors and other material
+	// parameters are looked up in the shaders.
+	uint32_t material;
 };
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <iterator>
+#include <glm/glm.hpp>
+#include <glm/trigonometric.hpp>
+#include "obj_parser/vertex.hh"
+#include "obj_parser/bounds.hh"
+
+// The form in which meshes are stored on the GPU, 16 bytes instead of the 28
+// of Vertex. Positions are unsigned normalized 16-bit integers within the
+// bounding box of the mesh, which the vertex shaders map back to model space,
+// see PositionQuantization. Normals are signed normalized 10-bit integers in
+// the GL_INT_2_10_10_10_REV format, which the shaders read as they read float
+// normals, so meshes from .glb files that are uploaded as they are work with
+// the same shaders. Every attribute starts at a multiple of four bytes.
+struct PackedVertex {
+	uint16_t pos[3];
+	uint16_t unused;
+	uint32_t normal;
+	// Index into the material table.
+	uint32_t material;
+};
+
+static_assert(sizeof(PackedVertex) == 16);
+
+// Only the position of a PackedVertex, for passes that only need the depth.
+struct PackedPosition {
+	uint16_t pos[3];
+	uint16_t unused;
+};
+
+static_assert(sizeof(PackedPosition) == 8);
+
+// Maps positions between model space and the quantized range, which is the
+// unit cube once OpenGL has normalized them.
+struct PositionQuantization {
+	glm::vec3 offset {0.0f};
+	glm::vec3 scale {1.0f};
+
+	// The box of the bounds becomes the unit cube. Flat boxes keep a scale of
+	// one on their flat axes.
+	[[nodiscard]] static PositionQuantization fromBounds(Bounds const &bounds) noexcept
+	{
+		PositionQuantization quantization;
+		if (bounds.isEmpty()) {
+			return quantization;
+		}
+		quantization.offset = bounds.min;
+		glm::vec3 extent = bounds.max - bounds.min;
+		for (int i = 0; i < 3; ++i) {
+			quantization.scale[i] = extent[i] > 0.0f ? extent[i] : 1.0f;
+		}
+		return quantization;
+	}
+};
+
+[[nodiscard]] inline PackedVertex packVertex(Vertex const &vertex, PositionQuantization const &quantization) noexcept
+{
+	PackedVertex packed {};
+	for (int i = 0; i < 3; ++i) {
+		float unit = std::clamp((vertex.pos[i] - quantization.offset[i]) / quantization.scale[i], 0.0f, 1.0f);
+		packed.pos[i] = static_cast<uint16_t>(std::lround(unit * float(UINT16_MAX)));
+
+		float component = std::clamp(vertex.normal[i], -1.0f, 1.0f);
+		auto value = static_cast<int32_t>(std::lround(component * 511.0f));
+		packed.normal |= (static_cast<uint32_t>(value) & 0x3ff) << (i * 10);
+	}
+	packed.material = vertex.material;
+	return packed;
+}
+
+[[nodiscard]] inline std::vector<PackedVertex> packVertices(
+	Vertex const *vertices,
+	size_t count,
+	PositionQuantization const &quantization)
+{
+	std::vector<PackedVertex> packed(count);
+	for (size_t i = 0; i < count; ++i) {
+		packed[i] = packVertex(vertices[i], quantization);
+	}
+	return packed;
+}
+
+[[nodiscard]] inline std::vector<PackedPosition> packPositions(PackedVertex const *vertices, size_t count)
+{
+	std::vector<PackedPosition> positions(count);
+	for (size_t i = 0; i < count; ++i) {
+		std::copy(std::begin(vertices[i].pos), std::end(vertices[i].pos), positions[i].pos);
+	}
+	return positions;
+}
+
+// What the vertex shaders see of a packed vertex.
+[[nodiscard]] inline glm::vec3 unpackPosition(PackedVertex const &packed, PositionQuantization const &quantization)
+{
+	glm::vec3 unit(packed.pos[0], packed.pos[1], packed.pos[2]);
+	return quantization.offset + quantization.scale * (unit / float(UINT16_MAX));
+}
+
+[[nodiscard]] inline glm::vec3 unpackNormal(uint32_t normal)
+{
+	glm::vec3 result;
+	for (int i = 0; i < 3; ++i) {
+		// Sign extend the 10-bit component.
+		auto value = static_cast<int32_t>(normal << (22 - i * 10)) >> 22;
+		result[i] = std::max(float(value) / 511.0f, -1.0f);
+	}
+	return result;
+}
+
+// Largest difference between the vertices and their packed form.
+struct QuantizationError {
+	// Distance in model space, and relative to the bounding sphere radius of
+	// the mesh. The error in every direction is at most half the size of the
+	// box divided by 65535.
+	float position {0.0f};
+	float relativePosition {0.0f};
+	// Angle between the normals, in degrees. At most about 0.1 degrees.
+	float normal {0.0f};
+
+	void merge(QuantizationError const &other) noexcept
+	{
+		position = std::max(position, other.position);
+		relativePosition = std::max(relativePosition, other.relativePosition);
+		normal = std::max(normal, other.normal);
+	}
+};
+
+[[nodiscard]] inline QuantizationError measureQuantizationError(
+	Vertex const *vertices,
+	PackedVertex const *packed,
+	size_t count,
+	Bounds const &bounds)
+{
+	PositionQuantization quantization = PositionQuantization::fromBounds(bounds);
+	QuantizationError error;
+	float cosine = 1.0f;
+	for (size_t i = 0; i < count; ++i) {
+		glm::vec3 offset = unpackPosition(packed[i], quantization) - vertices[i].pos;
+		error.position = std::max(error.position, glm::length(offset));
+		float length = glm::length(vertices[i].normal);
+		if (length > 0.0f) {
+			glm::vec3 normal = glm::normalize(unpackNormal(packed[i].normal));
+			cosine = std::min(cosine, glm::dot(normal, vertices[i].normal / length));
+		}
+	}
+	if (bounds.radius > 0.0f) {
+		error.relativePosition = error.position / bounds.radius;
+	}
+	error.normal = glm::degrees(std::acos(std::clamp(cosine, -1.0f, 1.0f)));
+	return error;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace util {
+
+inline unsigned hardwareThreadCount()
+{
+	return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Calls function(i) for every i in [0, count) on up to threadCount threads,
+// including the calling one. Indices are handed out one at a time, so uneven
+// work items are balanced automatically. If any call throws, the remaining
+// items are skipped and the first exception is rethrown on the caller.
+template<typename Function>
+void parallelFor(size_t count, unsigned threadCount, Function const &function)
+{
+	std::atomic<size_t> next {0};
+	std::exception_ptr error;
+	std::mutex errorMutex;
+
+	auto work = [&] {
+		for (size_t i = next++; i < count; i = next++) {
+			try {
+				function(i);
+			} catch (...) {
+				std::lock_guard lock(errorMutex);
+				if (!error) {
+					error = std::current_exception();
+				}
+				next = count;
+			}
+		}
+	};
+
+	size_t helperCount = std::min<size_t>(threadCount, count);
+	std::vector<std::thread> helpers;
+	for (size_t i = 1; i < helperCount; ++i) {
+		helpers.emplace_back(work);
+	}
+	work();
+	for (auto &thread: helpers) {
+		thread.join();
+	}
+
+	if (error) {
+		std::rethrow_exception(error);
+	}
+}
+
+}
@@ -59,13 +59,24 @@ public:
 		glUniform1f(getUniformLocation(name), f);
 	}
 
-	void setTexture(char const *name, int unit, GLuint texture) const
+	void setTexture(char const *name, int unit, GLuint texture, GLenum target = GL_TEXTURE_2D) const
 	{
 		glActiveTexture(GL_TEXTURE0 + unit);
-		glBindTexture(GL_TEXTURE_2D, texture);
+		glBindTexture(target, texture);
 		glUniform1i(getUniformLocation(name), unit);
 	}
 
+	// Connects a uniform block of the program to a buffer binding point.
+	void setUniformBlock(char const *name, GLuint bindingPoint) const
+	{
+		GLuint index = glGetUniformBlockIndex(handle, name);
+		if (index == GL_INVALID_INDEX) {
+			std::cout << "Uniform block does not exist: " << name << '\n';
+			return;
+		}
+		glUniformBlockBinding(handle, index, bindingPoint);
+	}
+
 private:
 	GLint getUniformLocation(char const *name) const
 	{
@@ -1,14 +1,33 @@
 #version 330 core
 
-uniform mat4 uModel;
 uniform mat4 uView;
 uniform mat4 uProj;
 uniform mat4 uLightView;
 uniform mat4 uLightProj;
 
-layout(location = 0) in vec4 aPosition;
+// Must match MaterialTable::MAX_MATERIALS.
+#define MAX_MATERIALS 1024
+
+struct Material {
+	vec4 diffuse;
+};
+
+layout(std140) uniform Materials {
+	Material uMaterials[MAX_MATERIALS];
+};
+
+// Five texels per mesh, see GeometryArena::setDraw: the first three rows of
+// the model matrix, the offset and the scale that map quantized positions to
+// model space. The w component of the offset is the material of the whole
+// mesh, or negative if the vertices have materials. In that case, the w
+// component of the scale is added to them.
+uniform samplerBuffer uDrawData;
+
+layout(location = 0) in vec3 aPosition;
 layout(location = 1) in vec3 aNormal;
-layout(location = 2) in vec3 aColor;
+layout(location = 2) in uint aMaterial;
+// Index of the mesh in uDrawData. Instances of the mesh follow it.
+layout(location = 3) in uint aDraw;
 
 out vec3 vNormal;
 out vec3 vWorldPosition;
@@ -16,11 +35,21 @@ out vec3 vColor;
 out vec4 vShadowCoordinates;
 
 void main() {
-	vec4 worldPosition = uModel * aPosition;
+	int texel = (int(aDraw) + gl_InstanceID) * 5;
+	mat4 model = transpose(mat4(
+		texelFetch(uDrawData, texel),
+		texelFetch(uDrawData, texel + 1),
+		texelFetch(uDrawData, texel + 2),
+		vec4(0.0, 0.0, 0.0, 1.0)));
+	vec4 offset = texelFetch(uDrawData, texel + 3);
+	vec4 scale = texelFetch(uDrawData, texel + 4);
+
+	vec4 worldPosition = model * vec4(offset.xyz + scale.xyz * aPosition, 1.0);
 	gl_Position = uProj * uView * worldPosition;
 
-	vNormal = mat3(uModel) * aNormal;
+	vNormal = mat3(model) * aNormal;
 	vWorldPosition = vec3(worldPosition);
-	vColor = aColor;
+	uint material = offset.w < 0.0 ? aMaterial + uint(scale.w) : uint(offset.w);
+	vColor = uMaterials[material].diffuse.rgb;
 	vShadowCoordinates = uLightProj * uLightView * worldPosition;
 }
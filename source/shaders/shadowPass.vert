@@ -1,13 +1,21 @@
 #version 330 core
 
-uniform mat4 uModel;
 uniform mat4 uView;
 uniform mat4 uProj;
+// See normalPass.vert.
+uniform samplerBuffer uDrawData;
 
-layout(location = 0) in vec4 aPosition;
-layout(location = 1) in vec3 aNormal;
-layout(location = 2) in vec3 aColor;
+layout(location = 0) in vec3 aPosition;
+layout(location = 3) in uint aDraw;
 
 void main() {
-	gl_Position = uProj * uView * uModel * aPosition;
+	int texel = (int(aDraw) + gl_InstanceID) * 5;
+	mat4 model = transpose(mat4(
+		texelFetch(uDrawData, texel),
+		texelFetch(uDrawData, texel + 1),
+		texelFetch(uDrawData, texel + 2),
+		vec4(0.0, 0.0, 0.0, 1.0)));
+	vec4 offset = texelFetch(uDrawData, texel + 3);
+	vec3 scale = texelFetch(uDrawData, texel + 4).xyz;
+	gl_Position = uProj * uView * model * vec4(offset.xyz + scale * aPosition, 1.0);
 }
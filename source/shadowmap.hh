@@ -3,9 +3,11 @@
 #include <glad.h>
 #include "camera.hh"
 #include "program.hh"
-#include "mesh.hh"
+#include "model.hh"
 
 class ShadowMap {
+	static constexpr int DRAW_DATA_UNIT {0};
+
 	Camera camera;
 	int resolution {1024};
 	GLuint depthAttachment {0};
@@ -43,7 +45,8 @@ public:
 		return camera;
 	}
 
-	void renderShadowPass(std::vector<Mesh> const &meshes) const
+	// The draw data of the model must have been uploaded.
+	void renderShadowPass(Model const &model) const
 	{
 		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
 		glViewport(0, 0, resolution, resolution);
@@ -53,11 +56,8 @@ public:
 		program.use();
 		program.set("uView", camera.viewMatrix);
 		program.set("uProj", camera.projMatrix);
-
-		for (auto const &mesh: meshes) {
-			program.set("uModel", mesh.getModelMatrix());
-			mesh.drawArrays();
-		}
+		program.setTexture("uDrawData", DRAW_DATA_UNIT, model.geometry->getDrawTexture(), GL_TEXTURE_BUFFER);
+		model.drawDepth();
 	}
 
 	[[nodiscard]] GLuint getDepthAttachment() const
@@ -1,9 +1,13 @@
 #pragma once
 
 #include <string>
+#include <cstdint>
+#include <cstring>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <string_view>
+#include <memory_resource>
 #include <glm/vec3.hpp>
 
 namespace util {
@@ -14,6 +18,36 @@ template<typename... Args>
 	throw (std::string(args) + ...);
 }
 
+// Copies the text into memory from the resource, usually an arena, and returns
+// a view of the copy.
+inline std::string_view intern(std::string_view text, std::pmr::memory_resource &resource)
+{
+	if (text.empty()) {
+		return {};
+	}
+	auto copy = static_cast<char *>(resource.allocate(text.size(), 1));
+	std::memcpy(copy, text.data(), text.size());
+	return {copy, text.size()};
+}
+
+// A fast non-cryptographic hash which only has to detect changed files. It
+// consumes eight bytes per step.
+inline uint64_t hashBytes(std::string_view bytes)
+{
+	uint64_t h = 0x9E3779B97F4A7C15ull ^ bytes.size();
+	size_t i = 0;
+	for (; i + 8 <= bytes.size(); i += 8) {
+		uint64_t word;
+		std::memcpy(&word, bytes.data() + i, sizeof(word));
+		h = (h ^ word) * 0xFF51AFD7ED558CCDull;
+		h ^= h >> 32;
+	}
+	for (; i < bytes.size(); ++i) {
+		h = (h ^ static_cast<unsigned char>(bytes[i])) * 0xC4CEB9FE1A85EC53ull;
+	}
+	return h ^ (h >> 29);
+}
+
 inline std::string readFileAsString(char const *path)
 {
 	std::ifstream file(path);
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <glad.h>
+#include "packed_vertex.hh"
+
+// Format and location of one vertex attribute in a vertex buffer, as it is
+// passed to glVertexAttribPointer.
+struct VertexAttribute {
+	GLint size {3};
+	GLenum type {GL_FLOAT};
+	bool normalized {false};
+	GLsizei stride {0};
+	size_t offset {0};
+};
+
+// Describes how the attributes of a mesh are stored in its vertex buffer.
+// Meshes from the OBJ parser are uploaded as PackedVertex, but any other
+// layout that OpenGL can read works as well, so vertex data from binary files
+// can be uploaded without converting it first.
+struct VertexLayout {
+	VertexAttribute position;
+	// Maps the position attribute to model space in the vertex shaders. The
+	// identity unless positions are quantized.
+	PositionQuantization quantization;
+	VertexAttribute normal;
+	// The material index is either read from the buffer as an unsigned
+	// integer, or it is the same for the whole mesh.
+	bool perVertexMaterial {true};
+	VertexAttribute material;
+	uint32_t constantMaterial {0};
+	// Added to the material indices of the vertices in the shaders, so that
+	// the vertices of a file do not depend on where its materials are in the
+	// table.
+	uint32_t materialOffset {0};
+	// Whether the vertices are PackedVertex, together with a position stream
+	// of PackedPosition for depth-only passes. Such meshes are stored in the
+	// GeometryArena if they have indices. Otherwise, depth-only passes read
+	// the position attribute from the vertex buffer of the mesh.
+	bool packedVertices {false};
+
+	// The layout of an array of PackedVertex, quantized within the bounds.
+	static VertexLayout packed(Bounds const &bounds) noexcept
+	{
+		return packed(PositionQuantization::fromBounds(bounds));
+	}
+
+	static VertexLayout packed(PositionQuantization const &quantization) noexcept
+	{
+		VertexLayout layout;
+		auto stride = static_cast<GLsizei>(sizeof(PackedVertex));
+		layout.position = {3, GL_UNSIGNED_SHORT, true, stride, offsetof(PackedVertex, pos)};
+		layout.quantization = quantization;
+		layout.normal = {4, GL_INT_2_10_10_10_REV, true, stride, offsetof(PackedVertex, normal)};
+		layout.material = {1, GL_UNSIGNED_INT, false, stride, offsetof(PackedVertex, material)};
+		layout.packedVertices = true;
+		return layout;
+	}
+};
+
+inline void setVertexAttribute(GLuint index, VertexAttribute const &attribute)
+{
+	glEnableVertexAttribArray(index);
+	glVertexAttribPointer(index, attribute.size, attribute.type, attribute.normalized, attribute.stride,
+	                      (GLvoid *) attribute.offset);
+}
+
+// For attributes that the shaders read as integers.
+inline void setIntegerVertexAttribute(GLuint index, VertexAttribute const &attribute)
+{
+	glEnableVertexAttribArray(index);
+	glVertexAttribIPointer(index, attribute.size, attribute.type, attribute.stride, (GLvoid *) attribute.offset);
+}